@@ -83,6 +83,11 @@ typedef void (*syscall_func_t)(struct pt_regs *regs);
 
 #define MAX_NUM_INTERRUPTS 64
 enum {
+	/* Software generated interrupts, 0 to 15. */
+	IRQ_IPI_RESCHEDULE = 0,
+	IRQ_IPI_CALL_FUNC = 1,
+	IRQ_IPI_WORK = 2,
+
 	IRQ_TIMER = 30,
 	IRQ_UART = 33,
 	IRQ_RTC = 34,
@@ -95,10 +100,12 @@ enum {
 	INT_TYPE_EDGE
 };
 
+/* The memory clobbers keep the compiler from moving accesses out of irq off regions. */
 static inline void enable_irq(void)
 {
 	asm volatile (
 		      "MSR DAIFClr, 0x2\n\t"
+		      : : : "memory"
 		      );
 }
 
@@ -106,6 +113,7 @@ static inline void disable_irq(void)
 {
 	asm volatile (
 		      "MSR DAIFSet, 0x2\n\t"
+		      : : : "memory"
 		      );
 }
 
@@ -124,9 +132,31 @@ static inline void disable_irq(void)
             "MSR DAIF, %x[reg_flags]\n\t" \
             : \
             :[reg_flags]"r"(flags) \
+            : "memory" \
         ); \
     } while (0);
 
+/* Full barrier between the cpus of the inner shareable domain. */
+static inline void smp_mb(void)
+{
+	asm volatile (
+		      "DMB ISH\n\t"
+		      : : : "memory"
+		      );
+}
+
+static inline int irqs_disabled(void)
+{
+	u64 daif;
+
+	asm volatile (
+		      "MRS %x[reg_daif], DAIF\n\t"
+		      :[reg_daif]"=r"(daif)
+		     );
+
+	return ((daif & (1 << 7)) != 0);
+}
+
 static inline void invalidate_tlb(void)
 {
 	asm volatile (
@@ -137,14 +167,15 @@ static inline void invalidate_tlb(void)
 		     );
 }
 
+/* Broadcast: the threads of an mm may run on the other cpus. */
 static inline void invalidate_tlb_by_asid(int asid)
 {
-	asm volatile("dsb ishst; tlbi aside1, %0; dsb ish; isb" : : "r"((u64)asid << 48));
+	asm volatile("dsb ishst; tlbi aside1is, %0; dsb ish; isb" : : "r"((u64)asid << 48));
 }
 
 static inline void invalidate_tlb_by_va(int asid, void *virt_addr)
 {
-	asm volatile("dsb ishst; tlbi vae1, %0; dsb ish; isb" : : "r"(((u64)asid << 48) | (((u64)virt_addr) >> 12)));
+	asm volatile("dsb ishst; tlbi vae1is, %0; dsb ish; isb" : : "r"(((u64)asid << 48) | (((u64)virt_addr) >> 12)));
 }
 
 static inline void write_ttbr0_el1(u64 pg_dir_phy_addr, int asid)
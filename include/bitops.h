@@ -0,0 +1,93 @@
+#ifndef _BITOPS_H
+#define _BITOPS_H
+
+/* Non-atomic bitmap helpers, the caller provides the locking. */
+
+#define BITS_PER_LONG 64
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void __set_bit(unsigned int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= (1UL << (nr % BITS_PER_LONG));
+}
+
+static inline void __clear_bit(unsigned int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(unsigned int nr, const unsigned long *addr)
+{
+	return ((addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1);
+}
+
+/* Index of the lowest set bit, word must not be 0. */
+static inline unsigned int __ffs(unsigned long word)
+{
+	return __builtin_ctzl(word);
+}
+
+/* Returns size if no bit is set. */
+static inline unsigned int find_first_bit(const unsigned long *addr,
+					  unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i * BITS_PER_LONG < size; i++) {
+		if (addr[i] != 0) {
+			unsigned int bit = i * BITS_PER_LONG + __ffs(addr[i]);
+
+			return (bit < size) ? bit : size;
+		}
+	}
+
+	return size;
+}
+
+/* Returns size if no bit is clear. */
+static inline unsigned int find_first_zero_bit(const unsigned long *addr,
+					       unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i * BITS_PER_LONG < size; i++) {
+		if (~addr[i] != 0) {
+			unsigned int bit = i * BITS_PER_LONG + __ffs(~addr[i]);
+
+			return (bit < size) ? bit : size;
+		}
+	}
+
+	return size;
+}
+
+/* First clear bit at or after offset, returns size if there's none. */
+static inline unsigned int find_next_zero_bit(const unsigned long *addr,
+					      unsigned int size,
+					      unsigned int offset)
+{
+	unsigned int i = offset / BITS_PER_LONG;
+	unsigned long word;
+
+	if (offset >= size) {
+		return size;
+	}
+
+	/* Bits below offset in the first word count as set. */
+	word = ~addr[i] & (~0UL << (offset % BITS_PER_LONG));
+	for (;;) {
+		if (word != 0) {
+			unsigned int bit = i * BITS_PER_LONG + __ffs(word);
+
+			return (bit < size) ? bit : size;
+		}
+		if (++i * BITS_PER_LONG >= size) {
+			return size;
+		}
+		word = ~addr[i];
+	}
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _CPUTIME_H
+#define _CPUTIME_H
+
+/*
+ * Cpu time accounting. CNTPCT_EL0 is sampled on every kernel entry from and
+ * exit to EL0, on irq and softirq entry and exit, and at context switch; the
+ * cycles since the previous sample are charged to the context that ran them.
+ */
+enum cpu_usage_stat {
+	CPUTIME_USER,
+	CPUTIME_SYSTEM,
+	CPUTIME_IRQ,
+	CPUTIME_SOFTIRQ,
+	CPUTIME_IDLE,
+	NR_CPUTIME_STATS
+};
+
+struct task_struct;
+struct rusage;
+
+void init_vtime(void);
+
+void vtime_account(void);
+void vtime_user_enter(void);
+void vtime_user_exit(void);
+
+void task_rusage(struct task_struct *t, struct rusage *ru);
+
+void dump_cputime_stats(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _FPSIMD_H
+#define _FPSIMD_H
+
+/*
+ * FP/SIMD registers of a task, saved lazily. Only user code uses them, the
+ * kernel is built with -mgeneral-regs-only. The layout is known by
+ * fpsimd.S.
+ */
+struct fpsimd_state {
+	u64 vregs[32 * 2];	/* Q0 to Q31. */
+	u32 fpsr;
+	u32 fpcr;
+};
+
+struct task_struct;
+
+void fpsimd_save_state(struct fpsimd_state *state);
+void fpsimd_load_state(const struct fpsimd_state *state);
+
+void fpsimd_init_cpu(void);
+void fpsimd_thread_switch(struct task_struct *prev, struct task_struct *next);
+void fpsimd_preserve_current_state(void);
+void fpsimd_flush_task_state(struct task_struct *t);
+void fpsimd_release_task(struct task_struct *t);
+void do_fpsimd_acc(void);
+
+void dump_fpsimd_stats(void);
+
+#endif
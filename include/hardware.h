@@ -45,6 +45,7 @@
 #define TCR_IRGN_WBWA		(1 << 8)
 #define TCR_T0SZ(x)		((64 - (x)) << 0)
 #define TCR_T1SZ(x)		((64 - (x)) << 16)
+#define TCR_ASID16		(1UL << 36)
 
 /*
  * Memory types
@@ -6,8 +6,30 @@
 #define CNTFRQ_EL0_VALUE 62500000
 #define TICK_TIMER_COUNT (CNTFRQ_EL0_VALUE / (1000/TICK))
 
+#define USECS_TO_CYCLES(us) ((u64)(us) * CNTFRQ_EL0_VALUE / 1000000)
+
+/* Free running counter of the generic timer, in CNTFRQ_EL0_VALUE Hz. */
+static inline u64 get_cycles(void)
+{
+	return read_reg(CNTPCT_EL0);
+}
+
+/*
+ * Longest sleep of a cpu whose tick is stopped, in ticks. Wakeups from other
+ * cpus kick it with an IPI.
+ */
+#ifndef NOHZ_MAX_SLEEP_TICKS
+#define NOHZ_MAX_SLEEP_TICKS HZ
+#endif
+
 void config_hw_timer(void);
 void handle_timer_irq(void);
 uint64_t get_tick(void);
 
+void tick_nohz_program_next_event(void);
+void tick_nohz_restart(void);
+int tick_nohz_stopped(int cpu);
+void tick_nohz_timer_added(uint64_t expires);
+void dump_tick_stats(void);
+
 #endif
@@ -22,11 +22,59 @@ void *kzalloc(size_t size);
 
 void kfree(void *ptr);
 
+void dump_kmalloc_stats(void);
+
 void mem_init(void);
 
+/*
+ * Buddy allocator of the page pool: blocks of 2^order pages, order below
+ * MAX_ORDER. The whole pool is one block of the highest order.
+ */
+#define MAX_ORDER 17
+#define MAX_NUM_PAGES (PAGE_POOL_SIZE / PAGE_SIZE)
+
+struct page;
+extern struct page *mem_map;
+
+#define page_to_pfn(page) ((unsigned long)((page) - mem_map))
+#define pfn_to_page(pfn) (mem_map + (pfn))
+#define page_address(page) \
+	((void *)(PAGE_POOL_START + page_to_pfn(page) * PAGE_SIZE))
+#define virt_to_page(addr) \
+	pfn_to_page(((unsigned long)(addr) - PAGE_POOL_START) / PAGE_SIZE)
+#define page_in_pool(addr) ((unsigned long)(addr) >= PAGE_POOL_START && \
+			    (unsigned long)(addr) < PAGE_POOL_END)
+
+void init_page_alloc(void);
+
 void *get_free_pages(unsigned int order);
 
+/* Single pages come from a pool zeroed by kzerod, see create_kzerod(). */
 void *get_zeroed_pages(unsigned int order);
 
+int create_kzerod(void);
+
 void free_pages(void *addr, unsigned int order);
+
+/* Frees a page unlikely to be in the cache, it's reused last. */
+void free_cold_page(void *addr);
+
+/*
+ * Users of a single page, e.g. the processes sharing it since a fork. It has
+ * one when allocated, put_page() frees it with the last. Pages out of the
+ * pool, like the ones of the kernel image, are never freed.
+ */
+void get_page(void *addr);
+void put_page(void *addr);
+int page_count(void *addr);
+
+/*
+ * Mapped read-only where anonymous user memory is only read, out of the pool
+ * so that it's never counted nor freed.
+ */
+extern unsigned char empty_zero_page[];
+
+int fragmentation_index(unsigned int order);
+
+void dump_buddy_stats(void);
 #endif
@@ -1,11 +1,21 @@
 #ifndef _MM_H
 #define _MM_H
 
+#include <list.h>
+
+/* Bins of free blocks: 16-byte steps, then powers of two, see mm/mm.c. */
+#define NR_SMALL_BINS 32
+#define NR_BINS 48
+
 struct mem_pool {
 	void *start;
 	void *end;
 	void *(*sbrk_func)(intptr_t increment);
+	void *(*page_alloc_func)(size_t size);
+	void (*page_free_func)(void *addr, size_t size);
 	size_t total_length;
+	struct list_head bins[NR_BINS];
+	unsigned long long binmap;	/* Bit i is set when bins[i] isn't empty. */
 	void *lock;
 	void (*lock_init_func)(void *lock);
 	void (*lock_func)(void *lock);
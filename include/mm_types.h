@@ -2,6 +2,8 @@
 #define _MM_TYPES_H
 
 #include <list.h>
+#include <spinlock.h>
+#include <bitops.h>
 
 struct mm_struct;
 
@@ -19,10 +21,26 @@ struct vm_area_struct {
 	struct list_head pages_block_list;
 };
 
+typedef struct {
+	u64 id;		/* ASID and its generation, see mmu_context.h. */
+} mm_context_t;
+
+/* Stacks alloc_thread_stack() can hand out in one mm. */
+#define MAX_USER_THREAD_STACKS 32
+
+/*
+ * Shared by the threads clone() creates, freed with its last user.
+ * page_table_lock serializes the changes to the VMAs and the user page
+ * tables.
+ */
 struct mm_struct {
 	struct vm_area_struct *mmap;            /* list of VMAs */
 	unsigned long start_brk;
 	unsigned long brk;
+	mm_context_t context;
+	int mm_users;
+	struct spinlock page_table_lock;
+	DECLARE_BITMAP(thread_stacks, MAX_USER_THREAD_STACKS);	/* Slots in use. */
 };
 
 #define VM_READ 0x00000001
@@ -30,6 +48,19 @@ struct mm_struct {
 #define VM_EXEC 0x00000004
 #define VM_SHARED 0x00000008
 
+/* One per page of the page pool, see mm/page_alloc.c. */
+struct page {
+	struct list_head lru;	/* In a free list, when PG_buddy, PG_pcp or PG_zeroed. */
+	unsigned int flags;
+	unsigned int order;	/* Of the free block, when PG_buddy. */
+	int count;		/* Users of an allocated page, see get_page(). */
+};
+
+#define PG_buddy 0x1		/* First page of a free block. */
+#define PG_reserved 0x2		/* Never allocated, e.g. holds mem_map. */
+#define PG_pcp 0x4		/* In a per-cpu list of single pages. */
+#define PG_zeroed 0x8		/* In the pool of zeroed pages. */
+
 struct pages_block {
 	struct list_head list;
 	void *user_virt_addr;
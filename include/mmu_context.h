@@ -0,0 +1,28 @@
+#ifndef _MMU_CONTEXT_H
+#define _MMU_CONTEXT_H
+
+#include <mm_types.h>
+
+/*
+ * ASID allocator, re. arch/arm64/mm/context.c of Linux. mm->context.id holds
+ * a generation above the asid_bits low bits of the ASID. An mm whose
+ * generation is old gets a new ASID on its next switch in; when they run
+ * out, the generation is bumped and every cpu flushes its TLB once.
+ */
+
+/* ID_AA64MMFR0_EL1.ASIDBits, 8 or 16. */
+static inline unsigned int cpu_asid_bits(void)
+{
+	return (((read_reg(ID_AA64MMFR0_EL1) >> 4) & 0xF) == 2) ? 16 : 8;
+}
+
+extern u64 asid_mask;
+
+#define ASID(mm) ((mm)->context.id & asid_mask)
+
+void init_asids(void);
+void check_and_switch_context(struct mm_struct *mm, int cpu);
+
+void dump_asid_stats(void);
+
+#endif
@@ -2,14 +2,14 @@
 #define __MUTEX_H__
 
 #include <spinlock.h>
+#include <list.h>
 
 enum mutex_state {MUTEX_UNLOCKED=0, MUTEX_LOCKED};
 
 typedef struct mutex {
 	struct spinlock lock;
 	int state;
-	/* Use a bitmap for now, it's simpler. */
-	unsigned int waiting; /* Bitmap for waiting processes. */
+	struct list_head wait_list;	/* Waiting tasks, in FIFO order. */
 } mutex_t;
 
 void init_mutex(mutex_t *p);
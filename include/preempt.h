@@ -0,0 +1,77 @@
+#ifndef _PREEMPT_H
+#define _PREEMPT_H
+
+#include <percpu.h>
+
+/*
+ * Per-cpu preempt_count, re. include/linux/preempt.h. Bits 0-7 count the
+ * preempt_disable() nesting (every held spinlock), bits 8-15 the softirq
+ * nesting, bits 16-23 the hardirq one. The running task may be preempted
+ * only when it's 0. It's saved in the task_struct across context switches.
+ */
+#define PREEMPT_OFFSET	(1 << 0)
+#define SOFTIRQ_OFFSET	(1 << 8)
+#define HARDIRQ_OFFSET	(1 << 16)
+
+#define PREEMPT_MASK	0x000000ff
+#define SOFTIRQ_MASK	0x0000ff00
+#define HARDIRQ_MASK	0x00ff0000
+
+DECLARE_PER_CPU(int, __preempt_count);
+DECLARE_PER_CPU(int, __need_resched);
+
+static inline int preempt_count(void)
+{
+	return per_cpu(__preempt_count, get_cpu_core_id());
+}
+
+/* irqs are disabled, so that the task can't move to another cpu in between. */
+static inline void preempt_count_add(int val)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	per_cpu(__preempt_count, get_cpu_core_id()) += val;
+	local_irq_restore(flags);
+}
+
+static inline void preempt_count_sub(int val)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	per_cpu(__preempt_count, get_cpu_core_id()) -= val;
+	local_irq_restore(flags);
+}
+
+#define in_irq() (preempt_count() & HARDIRQ_MASK)
+#define in_softirq() (preempt_count() & SOFTIRQ_MASK)
+#define in_interrupt() (preempt_count() & (HARDIRQ_MASK | SOFTIRQ_MASK))
+
+static inline int need_resched(void)
+{
+	return per_cpu(__need_resched, get_cpu_core_id());
+}
+
+static inline void set_need_resched(void)
+{
+	per_cpu(__need_resched, get_cpu_core_id()) = true;
+}
+
+void preempt_schedule(void);
+void preempt_schedule_irq(void);
+
+#define preempt_disable() preempt_count_add(PREEMPT_OFFSET)
+
+#define preempt_enable_no_resched() preempt_count_sub(PREEMPT_OFFSET)
+
+/* Preemption point: run a waiting task if this was the outermost section. */
+#define preempt_enable()				\
+	do {						\
+		preempt_enable_no_resched();		\
+		if (need_resched()) {			\
+			preempt_schedule();		\
+		}					\
+	} while (0)
+
+#endif
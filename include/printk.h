@@ -5,6 +5,8 @@ void init_printk(void);
 
 int printk(const char *fmt, ...);
 
+void printk_ipi_work(void);
+
 void test_printk(void);
 
 #endif
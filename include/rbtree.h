@@ -0,0 +1,58 @@
+#ifndef _RBTREE_H
+#define _RBTREE_H
+
+/*
+ * Red-black tree, re. include/linux/rbtree.h, simplified: the parent pointer
+ * and the color are kept in separate fields.
+ *
+ * The user embeds struct rb_node in its own structure, searches the tree for
+ * the insertion point, then calls rb_link_node() and rb_insert_color().
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { RB_RED = 0, RB_BLACK = 1 };
+
+struct rb_node {
+	struct rb_node *rb_parent;
+	int rb_color;
+	struct rb_node *rb_right;
+	struct rb_node *rb_left;
+};
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+#define RB_ROOT (struct rb_root) { NULL, }
+
+#define rb_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - (unsigned long)(&((type *)0)->member)))
+
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+				struct rb_node **rb_link)
+{
+	node->rb_parent = parent;
+	node->rb_color = RB_RED;
+	node->rb_left = node->rb_right = NULL;
+
+	*rb_link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _RESOURCE_H
+#define _RESOURCE_H
+
+#include <time.h>
+
+/* getrusage(), shared by the kernel and userspace. */
+#define RUSAGE_SELF 0
+
+/* ru_irqtime and ru_softirqtime are not in POSIX. */
+struct rusage {
+	struct timeval ru_utime;
+	struct timeval ru_stime;
+	struct timeval ru_irqtime;
+	struct timeval ru_softirqtime;
+};
+
+#endif
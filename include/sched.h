@@ -2,10 +2,21 @@
 #define __SCHED_H__
 
 #include <mm_types.h>
+#include <rbtree.h>
+#include <sched_param.h>
+#include <fpsimd.h>
+#include <wait.h>
 
 #define USER_STACK_START 0x20000000
 #define USER_STACK_SIZE 0x800000
 
+/*
+ * Stacks of the threads clone() creates without one, above the main stack.
+ * A slot is freed with its VMA when its thread exits.
+ */
+#define USER_THREAD_STACKS_START (USER_STACK_START + USER_STACK_SIZE)
+#define USER_THREAD_STACK_SIZE 0x100000
+
 #define MAX_BRK_ADDR 0x0C000000
 
 struct cpu_context {
@@ -26,10 +37,47 @@ struct cpu_context {
 
 struct thread_struct {
 	struct cpu_context cpu_context;
+	struct fpsimd_state fpsimd_state;
+	int fpsimd_cpu;		/* Cpu whose registers may hold the state. */
+	int fpsimd_used;
+	unsigned long tp_value;	/* TPIDR_EL0, the thread pointer of EL0. */
 };
 
 #define TASK_COMM_LEN 16
 
+/* One bit per cpu, NUM_CPUS is at most 64. */
+typedef u64 cpumask_t;
+
+#define CPU_MASK_ALL ((cpumask_t)(((NUM_CPUS) == 64) ? ~0ULL : ((1ULL << (NUM_CPUS)) - 1)))
+#define cpumask_test_cpu(cpu, mask) (((mask) >> (cpu)) & 1)
+
+/* Times are in CNTPCT_EL0 cycles. */
+struct sched_entity {
+	struct rb_node run_node;
+	u64 vruntime;
+	u64 exec_start;
+	u64 sum_exec_runtime;
+	u64 prev_sum_exec_runtime;
+};
+
+/*
+ * Real-time tasks are queued in FIFO order per priority. time_slice counts
+ * the ticks left for SCHED_RR.
+ */
+struct sched_rt_entity {
+	struct list_head run_list;
+	unsigned int time_slice;
+};
+
+struct sched_class;
+
+/*
+ * prio is the effective priority, lower is more urgent: real-time tasks are
+ * in 0 to MAX_RT_PRIO - 1, all the SCHED_NORMAL ones are at MAX_RT_PRIO.
+ */
+#define MAX_RT_PRIO MAX_USER_RT_PRIO
+#define NORMAL_PRIO MAX_RT_PRIO
+
 struct task_struct {
 	volatile long state;
 	void *stack;
@@ -39,8 +87,35 @@ struct task_struct {
 	char comm[TASK_COMM_LEN];
 	uint64_t *pg_dir;
 	struct mm_struct *mm;
-	u64 stime;
+	unsigned long thread_stack;	/* From alloc_thread_stack(), or 0. */
+	u64 stime;		/* In cycles, see cputime.h. */
 	u64 utime;
+	u64 irqtime;
+	u64 softirqtime;
+	int cpu;		/* Run queue the task belongs to. */
+	int on_rq;
+	int on_cpu;		/* Running, or still switching out. */
+	cpumask_t cpus_allowed;
+	struct sched_entity se;
+	int policy;
+	int rt_priority;
+	int prio;
+	const struct sched_class *sched_class;
+	struct sched_rt_entity rt;
+	int preempt_count;	/* Saved while switched out. */
+	struct list_head tasks;		/* All tasks, or the dead ones. */
+	struct list_head pid_chain;	/* pid hash bucket. */
+	/*
+	 * Forked tasks have a parent that collects their exit code, kernel
+	 * threads and orphans have none and are reaped right away. All under
+	 * tasks_lock.
+	 */
+	struct task_struct *parent;
+	struct list_head children;
+	struct list_head sibling;	/* In the parent's children. */
+	int exit_state;
+	int exit_code;
+	struct wait_queue_head wait_chldexit;	/* The parent waits here. */
 };
 
 struct thread_info {
@@ -56,6 +131,7 @@ extern struct task_struct *__switch_to(struct task_struct *,
 	} while (0)
 
 #define KERNEL_STACK_SIZE 4096
+#define KERNEL_STACK_ORDER 0	/* Of the get_free_pages() block. */
 
 static inline struct thread_info *current_thread_info(void)
 {
@@ -74,24 +150,87 @@ static inline struct thread_info *current_thread_info(void)
 
 void schedule(void);
 
+void schedule_tail(struct task_struct *prev);
+
+/*
+ * Fair scheduler tunables, in micro-seconds. A running task is not preempted
+ * by the tick before it has run for the minimum granularity; a waking sleeper
+ * gets at most half of the latency as vruntime credit, and preempts the
+ * running task if it's behind by more than the wakeup granularity.
+ */
+#ifndef SCHED_MIN_GRANULARITY_US
+#define SCHED_MIN_GRANULARITY_US 4000
+#endif
+#ifndef SCHED_LATENCY_US
+#define SCHED_LATENCY_US 20000
+#endif
+#ifndef SCHED_WAKEUP_GRANULARITY_US
+#define SCHED_WAKEUP_GRANULARITY_US 1000
+#endif
+
+/*
+ * Load balancing: a task that ran within the migration cost is cache hot and
+ * is not stolen. The periodic pass runs every SCHED_BALANCE_INTERVAL ticks.
+ */
+#ifndef SCHED_MIGRATION_COST_US
+#define SCHED_MIGRATION_COST_US 500
+#endif
+#ifndef SCHED_BALANCE_INTERVAL
+#define SCHED_BALANCE_INTERVAL 4
+#endif
+
+/* SCHED_RR time slice, in ticks. */
+#ifndef SCHED_RR_TIMESLICE
+#define SCHED_RR_TIMESLICE (100 / TICK)
+#endif
+
+void sched_set_min_granularity(unsigned int usecs);
+
+void sched_fork(struct task_struct *t);
+
+void scheduler_tick(void);
+
+unsigned int nr_running_cpu(int cpu);
+
+int set_cpus_allowed(struct task_struct *t, cpumask_t new_mask);
+int sched_setaffinity(int pid, cpumask_t new_mask);
+
+int sched_setscheduler(struct task_struct *t, int policy,
+		       const struct sched_param *param);
+int do_sched_setscheduler(int pid, int policy,
+			  const struct sched_param *param);
+
 int schedule_timeout(unsigned int timeout);
 
 void msleep(unsigned int msecs);
 
 int kernel_thread(const char *name, const void *fn, const void *args);
 
-#define MAX_NUM_PROCESSES 32
+/* Pids are 1 to PID_MAX - 1, 0 is the idle tasks'. */
+#ifndef PID_MAX
+#define PID_MAX 32768
+#endif
+
+enum process_state {INITIALIZING, RUNNING, SLEEPING, STOPPED, ZOMBIE, NUM_PROC_STATES};
 
-enum process_state {INITIALIZING, RUNNING, SLEEPING, STOPPED, NUM_PROC_STATES};
+/* exit_state, once a child with a parent has exited. */
+#define EXIT_ZOMBIE 1
 
 void dump_tasks(void);
 
+void dump_sched_stats(void);
+
 void switch_to_user_mode(uint64_t user_pc, uint64_t user_sp);
 
 struct task_struct *get_current_proc(void);
 
 void do_exit(unsigned long ret_val);
 
+void link_child(struct task_struct *parent, struct task_struct *child);
+
+struct rusage;
+int do_wait(int pid, int *status, int options, struct rusage *ru);
+
 int setup_vma(struct task_struct *t, unsigned long vm_start,
 	      unsigned long vm_end, unsigned long vm_flags,
 	      unsigned long lma);
@@ -103,6 +242,8 @@ void dump_vmas(struct task_struct *t);
 
 int add_pages_block(struct vm_area_struct *vma, void *user_virt_addr,
 		    void *linear_addr, unsigned int order);
+/* Unlinks pb from its vma and frees it, not the pages. */
+void del_pages_block(struct pages_block *pb);
 
 void setup_user_page_mapping(uint64_t *pg_dir, void *virt_addr,
 				    void *phy_addr, size_t size,
@@ -111,12 +252,27 @@ void setup_user_page_mappings(struct task_struct *t);
 
 int unmap_user_page_mapping(int asid, uint64_t *pg_dir, void *virt_addr, size_t size);
 
+int copy_page_range(int asid, uint64_t *dst_pg_dir, uint64_t *src_pg_dir,
+		    struct vm_area_struct *dst_vma, struct vm_area_struct *vma);
+int do_wp_page(struct mm_struct *mm, uint64_t *pg_dir,
+	       struct vm_area_struct *vma, unsigned long addr);
+
 struct task_struct *get_task_slot(void);
 
 void free_task_slot(struct task_struct *t);
 
+struct mm_struct *mm_alloc(void);
+void mmget(struct mm_struct *mm);
+
+unsigned long alloc_thread_stack(struct task_struct *t);
+void free_thread_stack(struct task_struct *t);
+
+int user_page_mapped(uint64_t *pg_dir, unsigned long addr);
+
 void exit_mm(struct task_struct *tsk);
 
+void activate_mm(struct task_struct *t);
+
 void init_sched(void);
 
 struct task_struct *pid_to_task(int pid);
@@ -0,0 +1,20 @@
+#ifndef _SCHED_PARAM_H
+#define _SCHED_PARAM_H
+
+/* Scheduling policies, shared by the kernel and userspace. */
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+/* Valid SCHED_FIFO/SCHED_RR priorities are 1 to MAX_USER_RT_PRIO - 1. */
+#define MAX_USER_RT_PRIO 100
+
+struct sched_param {
+	int sched_priority;
+};
+
+/* clone() flags, the values of Linux. */
+#define CLONE_VM 0x00000100		/* Share the address space. */
+#define CLONE_SETTLS 0x00080000	/* Set TPIDR_EL0 of the child. */
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stddef.h>
+
+/*
+ * Caches of objects of one size, re. mm/slab.c of Linux. Objects are carved
+ * from slabs of pages with no header of their own; each cpu keeps a magazine
+ * of free objects that it takes without a lock. The constructor runs once
+ * per object when its slab is created, a freed object must be back in its
+ * constructed state.
+ */
+
+#define SLAB_HWCACHE_ALIGN 0x1	/* Objects start on a cache line. */
+#define SLAB_TYPESAFE 0x2	/* Slabs are never freed: a stale pointer still
+				 * points to an object of the cache. */
+
+struct kmem_cache;
+
+void kmem_cache_init(void);
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned int flags,
+				     void (*ctor)(void *obj));
+/* No object may be in use. */
+int kmem_cache_destroy(struct kmem_cache *cachep);
+
+void *kmem_cache_alloc(struct kmem_cache *cachep);
+void *kmem_cache_zalloc(struct kmem_cache *cachep);
+void kmem_cache_free(struct kmem_cache *cachep, void *obj);
+
+/* Frees the empty slabs, returns the number of pages freed. */
+int kmem_cache_shrink(struct kmem_cache *cachep);
+
+void dump_slab_stats(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+/* Inter-processor interrupts, sent as GICv2 software generated interrupts. */
+
+void init_ipi(void);
+int cpu_online(int cpu);
+
+void smp_send_reschedule(int cpu);
+void smp_send_work_ipi(void);
+int smp_call_function(void (*func)(void *info), void *info, int wait);
+
+void handle_ipi_reschedule(void);
+void handle_ipi_call_function(void);
+void handle_ipi_work(void);
+
+void dump_ipi_stats(void);
+
+#endif
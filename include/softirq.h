@@ -3,6 +3,7 @@
 
 enum {
 	SOFTIRQ_TIMER = 0,
+	SOFTIRQ_SCHED,
 	MAX_NUM_SOFTIRQ
 };
 
@@ -12,4 +13,7 @@ extern void raise_softirq(unsigned int nr);
 
 extern void do_softirq(void);
 
+extern void irq_enter(void);
+extern void irq_exit(void);
+
 #endif
@@ -7,6 +7,8 @@ struct spinlock {
 };
 
 void spin_lock_init(struct spinlock *lock);
+void arch_spin_lock(struct spinlock *lock);
+void arch_spin_unlock(struct spinlock *lock);
 void spin_lock(struct spinlock *lock);
 void spin_unlock(struct spinlock *lock);
 
@@ -8,4 +8,9 @@ struct timespec {
 	long   tv_nsec;       /* nanoseconds */
 };
 
+struct timeval {
+	time_t tv_sec;        /* seconds */
+	long   tv_usec;       /* microseconds */
+};
+
 #endif
@@ -14,6 +14,7 @@ extern void del_timer(struct timer *p);
 extern void mod_timer(struct timer *p, unsigned long expires);
 
 extern void run_timer_softirq(void);
+extern int next_timer_interrupt(uint64_t *next);
 
 void init_timer_module(void);
 
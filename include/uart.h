@@ -8,4 +8,6 @@ void write_char_uart(char c);
 
 #define UART_IRQ_MODE
 
+#define UART_IN_BUF_LEN 256
+
 #endif
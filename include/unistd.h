@@ -2,6 +2,9 @@
 #define _UNISTD_H
 
 #include <time.h>
+#include <sched_param.h>
+#include <resource.h>
+#include <waitstatus.h>
 
 #define __NR_fork "0"
 #define __NR_brk "1"
@@ -10,9 +13,27 @@
 #define __NR_pause "4"
 #define __NR_read "5"
 #define __NR_write "6"
+#define __NR_sched_setaffinity "7"
+#define __NR_sched_getaffinity "8"
+#define __NR_sched_setscheduler "9"
+#define __NR_sched_getscheduler "10"
+#define __NR_getrusage "11"
+#define __NR_wait4 "12"
+#define __NR_clone "13"
 
 typedef long pid_t;
 
+/* One bit per cpu. */
+typedef struct {
+	unsigned long __bits[1];
+} cpu_set_t;
+
+#define CPU_SETSIZE (8 * sizeof (unsigned long))
+#define CPU_ZERO(set) ((set)->__bits[0] = 0)
+#define CPU_SET(cpu, set) ((set)->__bits[0] |= (1UL << (cpu)))
+#define CPU_CLR(cpu, set) ((set)->__bits[0] &= ~(1UL << (cpu)))
+#define CPU_ISSET(cpu, set) (((set)->__bits[0] >> (cpu)) & 1)
+
 pid_t fork(void);
 int brk(void *addr);
 void *sbrk(intptr_t increment);
@@ -24,4 +45,21 @@ int pause(void);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+int sched_getscheduler(pid_t pid);
+
+int getrusage(int who, struct rusage *usage);
+
+pid_t wait4(pid_t pid, int *status, int options, struct rusage *rusage);
+pid_t waitpid(pid_t pid, int *status, int options);
+pid_t wait(int *status);
+
+/*
+ * fn(arg) runs in a child that shares the address space with CLONE_VM, on
+ * stack if it's not NULL, and exits with what fn returns.
+ */
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, void *tls);
+
 #endif
@@ -2,9 +2,10 @@
 #define __WAIT_H
 
 #include <list.h>
-#include <sched.h>
 #include <spinlock.h>
 
+struct task_struct;
+
 struct wait_queue_entry {
 	struct task_struct *task;
 	struct list_head entry;
@@ -0,0 +1,12 @@
+#ifndef _WAITSTATUS_H
+#define _WAITSTATUS_H
+
+/* wait4(), shared by the kernel and userspace. */
+#define WNOHANG 1
+
+/* The exit code is in bits 8-15 of the status. */
+#define __W_EXITCODE(ret) (((ret) & 0xFF) << 8)
+#define WEXITSTATUS(status) (((status) >> 8) & 0xFF)
+#define WIFEXITED(status) (((status) & 0x7F) == 0)
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include <list.h>
+#include <timer.h>
+
+/*
+ * Deferred work run by per-cpu kernel threads, re. kernel/workqueue.c of
+ * Linux. A work item is queued at most once: queueing a pending item does
+ * nothing. It may queue itself again from its function.
+ */
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	struct list_head entry;
+	work_func_t func;
+	int pending;
+};
+
+/* Queued on cpu when timer expires. */
+struct delayed_work {
+	struct work_struct work;
+	struct timer timer;
+	int cpu;
+};
+
+#define INIT_WORK(_work, _func)					\
+	do {								\
+		INIT_LIST_HEAD(&(_work)->entry);			\
+		(_work)->func = (_func);				\
+		(_work)->pending = false;				\
+	} while (0)
+
+#define INIT_DELAYED_WORK(_dwork, _func)				\
+	do {								\
+		INIT_WORK(&(_dwork)->work, (_func));			\
+		init_timer(&(_dwork)->timer);				\
+	} while (0)
+
+#define to_delayed_work(_work) container_of(_work, struct delayed_work, work)
+
+/* The workers run work as SCHED_FIFO, CPU hogs must not delay it. */
+#ifndef WORKER_RT_PRIO
+#define WORKER_RT_PRIO 50
+#endif
+
+/*
+ * May be called from irq context. Return true if work was queued, false if
+ * it was pending already, -1 on error.
+ */
+int queue_work_on(int cpu, struct work_struct *work);
+int schedule_work(struct work_struct *work);
+
+/* delay is in ticks. */
+int queue_delayed_work_on(int cpu, struct delayed_work *dwork,
+			  unsigned long delay);
+int schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+
+void init_workqueues(void);
+int create_workers(void);
+
+void dump_workqueue_stats(void);
+
+#endif
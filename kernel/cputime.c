@@ -0,0 +1,131 @@
+#include <arch.h>
+#include <printk.h>
+#include <percpu.h>
+#include <preempt.h>
+#include <sched.h>
+#include <hw_timer.h>
+#include <resource.h>
+#include <cputime.h>
+
+static DEFINE_PER_CPU(u64, vtime_snap);
+static DEFINE_PER_CPU(u64[NR_CPUTIME_STATS], cpustat);
+
+/* Called by each cpu before it takes interrupts. */
+void init_vtime(void)
+{
+	per_cpu(vtime_snap, get_cpu_core_id()) = get_cycles();
+}
+
+/* Cycles since the previous sample, irqs are disabled. */
+static u64 vtime_delta(int cpu)
+{
+	u64 now = get_cycles();
+	u64 delta = now - per_cpu(vtime_snap, cpu);
+
+	per_cpu(vtime_snap, cpu) = now;
+
+	return delta;
+}
+
+static void account_time(struct task_struct *t, int cpu,
+			 enum cpu_usage_stat index, u64 delta)
+{
+	per_cpu(cpustat, cpu)[index] += delta;
+
+	switch (index) {
+	case CPUTIME_USER:
+		t->utime += delta;
+		break;
+	case CPUTIME_SYSTEM:
+		t->stime += delta;
+		break;
+	case CPUTIME_IRQ:
+		t->irqtime += delta;
+		break;
+	case CPUTIME_SOFTIRQ:
+		t->softirqtime += delta;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Charge the cycles since the previous sample to the kernel context that ran
+ * them, from preempt_count. The idle task's own time is idle time.
+ */
+void vtime_account(void)
+{
+	struct task_struct *t;
+	int cpu;
+	enum cpu_usage_stat index;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	t = get_current_proc();
+	cpu = get_cpu_core_id();
+	if (in_irq()) {
+		index = CPUTIME_IRQ;
+	} else if (in_softirq()) {
+		index = CPUTIME_SOFTIRQ;
+	} else if (t->pid == 0) {
+		index = CPUTIME_IDLE;
+	} else {
+		index = CPUTIME_SYSTEM;
+	}
+	account_time(t, cpu, index, vtime_delta(cpu));
+	local_irq_restore(flags);
+}
+
+/* Called right before returning to EL0, the kernel time ends. */
+void vtime_user_enter(void)
+{
+	vtime_account();
+}
+
+/* Called right after entering from EL0, with irqs disabled. */
+void vtime_user_exit(void)
+{
+	int cpu = get_cpu_core_id();
+
+	account_time(get_current_proc(), cpu, CPUTIME_USER, vtime_delta(cpu));
+}
+
+static void cycles_to_timeval(u64 cycles, struct timeval *tv)
+{
+	tv->tv_sec = cycles / CNTFRQ_EL0_VALUE;
+	tv->tv_usec = (cycles % CNTFRQ_EL0_VALUE) * 1000000 / CNTFRQ_EL0_VALUE;
+}
+
+/* Times of t, t is current or not running. */
+void task_rusage(struct task_struct *t, struct rusage *ru)
+{
+	if (t == NULL || ru == NULL) {
+		printk("%s: t or ru is null\n", __FUNCTION__);
+		return;
+	}
+
+	if (t == get_current_proc()) {
+		vtime_account();
+	}
+	cycles_to_timeval(t->utime, &ru->ru_utime);
+	cycles_to_timeval(t->stime, &ru->ru_stime);
+	cycles_to_timeval(t->irqtime, &ru->ru_irqtime);
+	cycles_to_timeval(t->softirqtime, &ru->ru_softirqtime);
+}
+
+void dump_cputime_stats(void)
+{
+	u64 ms = USECS_TO_CYCLES(1000);
+	int i;
+
+	vtime_account();
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("cpu%d: user=%dms, system=%dms, irq=%dms, softirq=%dms, idle=%dms\n",
+		       i, (u32)(per_cpu(cpustat, i)[CPUTIME_USER] / ms),
+		       (u32)(per_cpu(cpustat, i)[CPUTIME_SYSTEM] / ms),
+		       (u32)(per_cpu(cpustat, i)[CPUTIME_IRQ] / ms),
+		       (u32)(per_cpu(cpustat, i)[CPUTIME_SOFTIRQ] / ms),
+		       (u32)(per_cpu(cpustat, i)[CPUTIME_IDLE] / ms));
+	}
+}
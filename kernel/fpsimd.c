@@ -0,0 +1,145 @@
+#include <arch.h>
+#include <printk.h>
+#include <percpu.h>
+#include <string.h>
+#include <sched.h>
+#include <fpsimd.h>
+
+/*
+ * Lazy FP/SIMD switching, re. arch/arm64/kernel/fpsimd.c of Linux.
+ *
+ * EL0 accesses trap through CPACR_EL1.FPEN until the running task owns the
+ * registers of the cpu. The owner's registers are saved when it's switched
+ * out, and stay loaded: if it's the next one to run on that cpu again, they
+ * are used as they are. Tasks that never use FP/SIMD never trap and have
+ * nothing saved.
+ */
+
+#define CPACR_EL1_FPEN_SHIFT 20
+#define CPACR_EL1_FPEN_TRAP_EL0 (1UL << CPACR_EL1_FPEN_SHIFT)
+#define CPACR_EL1_FPEN_NO_TRAP (3UL << CPACR_EL1_FPEN_SHIFT)
+
+/* Task whose state was last loaded in, or saved from, the cpu's registers. */
+static DEFINE_PER_CPU(struct task_struct *, fpsimd_last_state);
+/* The running task owns the registers, EL0 accesses don't trap. */
+static DEFINE_PER_CPU(int, fpsimd_live);
+
+static DEFINE_PER_CPU(unsigned int, fpsimd_traps);
+static DEFINE_PER_CPU(unsigned int, fpsimd_saves);
+static DEFINE_PER_CPU(unsigned int, fpsimd_reuses);
+
+static void fpsimd_set_live(int cpu, int live)
+{
+	if (per_cpu(fpsimd_live, cpu) == live) {
+		return;
+	}
+
+	per_cpu(fpsimd_live, cpu) = live;
+	write_sys_reg(CPACR_EL1, live ? CPACR_EL1_FPEN_NO_TRAP :
+		      CPACR_EL1_FPEN_TRAP_EL0);
+}
+
+/* Called by each cpu at boot, EL0 accesses trap. */
+void fpsimd_init_cpu(void)
+{
+	int cpu = get_cpu_core_id();
+
+	per_cpu(fpsimd_last_state, cpu) = NULL;
+	per_cpu(fpsimd_live, cpu) = false;
+	write_sys_reg(CPACR_EL1, CPACR_EL1_FPEN_TRAP_EL0);
+}
+
+/* Called by __switch_to() with irqs disabled. */
+void fpsimd_thread_switch(struct task_struct *prev, struct task_struct *next)
+{
+	int cpu = get_cpu_core_id();
+
+	if (per_cpu(fpsimd_live, cpu)) {
+		fpsimd_save_state(&prev->thread.fpsimd_state);
+		per_cpu(fpsimd_saves, cpu)++;
+	}
+
+	if (per_cpu(fpsimd_last_state, cpu) == next &&
+	    next->thread.fpsimd_cpu == cpu) {
+		per_cpu(fpsimd_reuses, cpu)++;
+		fpsimd_set_live(cpu, true);
+	} else {
+		fpsimd_set_live(cpu, false);
+	}
+}
+
+/* Brings the saved state of current up to date, e.g. before fork copies it. */
+void fpsimd_preserve_current_state(void)
+{
+	unsigned long flags;
+	int cpu;
+
+	local_irq_save(flags);
+	cpu = get_cpu_core_id();
+	if (per_cpu(fpsimd_live, cpu)) {
+		fpsimd_save_state(&get_current_proc()->thread.fpsimd_state);
+		per_cpu(fpsimd_saves, cpu)++;
+	}
+	local_irq_restore(flags);
+}
+
+/* The registers of no cpu hold t's state, e.g. for a new task. */
+void fpsimd_flush_task_state(struct task_struct *t)
+{
+	t->thread.fpsimd_cpu = NUM_CPUS;
+}
+
+/*
+ * t is being freed: forget it as the last owner of any cpu's registers, so
+ * that a task_struct reusing its memory can't take them as its own.
+ */
+void fpsimd_release_task(struct task_struct *t)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		if (per_cpu(fpsimd_last_state, i) == t) {
+			per_cpu(fpsimd_last_state, i) = NULL;
+		}
+	}
+}
+
+/*
+ * First FP/SIMD access of current since it was switched in: load its state,
+ * zeroed if it never used FP/SIMD before, and stop trapping.
+ */
+void do_fpsimd_acc(void)
+{
+	struct task_struct *current;
+	unsigned long flags;
+	int cpu;
+
+	local_irq_save(flags);
+	current = get_current_proc();
+	cpu = get_cpu_core_id();
+	per_cpu(fpsimd_traps, cpu)++;
+
+	if (!current->thread.fpsimd_used) {
+		memset(&current->thread.fpsimd_state, 0,
+		       sizeof (current->thread.fpsimd_state));
+		current->thread.fpsimd_used = true;
+	}
+
+	/* CPACR_EL1_FPEN_TRAP_EL0 leaves EL1 accesses alone. */
+	fpsimd_load_state(&current->thread.fpsimd_state);
+	per_cpu(fpsimd_last_state, cpu) = current;
+	current->thread.fpsimd_cpu = cpu;
+	fpsimd_set_live(cpu, true);
+	local_irq_restore(flags);
+}
+
+void dump_fpsimd_stats(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("cpu%d: fpsimd traps=%d, saves=%d, reuses=%d, last_state=%p\n",
+		       i, per_cpu(fpsimd_traps, i), per_cpu(fpsimd_saves, i),
+		       per_cpu(fpsimd_reuses, i), per_cpu(fpsimd_last_state, i));
+	}
+}
@@ -4,8 +4,12 @@
 #include <misc.h>
 #include <softirq.h>
 #include <timer.h>
+#include <percpu.h>
+#include <sched.h>
 
-static uint64_t tick;
+/* Whether the periodic tick of the cpu is stopped. */
+static DEFINE_PER_CPU(int, tick_stopped);
+static DEFINE_PER_CPU(unsigned int, nohz_sleeps);
 
 void config_hw_timer(void)
 {
@@ -23,27 +27,110 @@ void config_hw_timer(void)
 	reg = read_reg(CNTP_CTL_EL0);
 	printk("CNTP_CTL_EL0=%d\n", reg);
 
-	write_sys_reg(CNTP_TVAL_EL0, TICK_TIMER_COUNT);
+	write_sys_reg(CNTP_CVAL_EL0, (get_tick() + 1) * TICK_TIMER_COUNT);
 	write_sys_reg(CNTP_CTL_EL0, 1);
 
 	open_softirq(SOFTIRQ_TIMER, run_timer_softirq);
 }
 
+/* Fire the timer at the start of jiffy expires. */
+static void program_tick(uint64_t expires)
+{
+	write_sys_reg(CNTP_CVAL_EL0, expires * TICK_TIMER_COUNT);
+}
+
+/*
+ * Program the next timer event of this cpu, irqs are disabled. The periodic
+ * tick is only needed to preempt when more than one task is runnable here;
+ * otherwise sleep until the earliest pending timer, at most
+ * NOHZ_MAX_SLEEP_TICKS.
+ */
+void tick_nohz_program_next_event(void)
+{
+	int cpu = get_cpu_core_id();
+	uint64_t now = get_tick();
+	uint64_t next;
+
+	if (nr_running_cpu(cpu) > 1) {
+		per_cpu(tick_stopped, cpu) = false;
+		program_tick(now + 1);
+		return;
+	}
+
+	next = now + NOHZ_MAX_SLEEP_TICKS;
+	if (next_timer_interrupt(&next) && (int64_t)(next - now) <= 0) {
+		next = now + 1;
+	}
+
+	if (next - now > 1) {
+		per_cpu(tick_stopped, cpu) = true;
+		per_cpu(nohz_sleeps, cpu)++;
+	} else {
+		per_cpu(tick_stopped, cpu) = false;
+	}
+	program_tick(next);
+}
+
+int tick_nohz_stopped(int cpu)
+{
+	return per_cpu(tick_stopped, cpu);
+}
+
+/* A second task became runnable on this cpu, bring the tick back. */
+void tick_nohz_restart(void)
+{
+	int cpu = get_cpu_core_id();
+
+	if (per_cpu(tick_stopped, cpu)) {
+		per_cpu(tick_stopped, cpu) = false;
+		program_tick(get_tick() + 1);
+	}
+}
+
+/* A timer expiring at expires was added, wake up for it if sleeping longer. */
+void tick_nohz_timer_added(uint64_t expires)
+{
+	unsigned long flags;
+	int cpu;
+
+	local_irq_save(flags);
+	cpu = get_cpu_core_id();
+	if (per_cpu(tick_stopped, cpu) &&
+	    expires * TICK_TIMER_COUNT < read_reg(CNTP_CVAL_EL0)) {
+		if ((int64_t)(expires - get_tick()) <= 0) {
+			expires = get_tick() + 1;
+		}
+		program_tick(expires);
+	}
+	local_irq_restore(flags);
+}
+
 void handle_timer_irq(void)
 {
-	write_sys_reg(CNTP_TVAL_EL0, TICK_TIMER_COUNT);
 #ifdef DEBUG_TIMER_IRQ
 	printk("core %d: Got timer interrupt.\n", get_cpu_core_id());
 	dump_stack();
 #endif
-	if (get_cpu_core_id() == 0) {
-		tick++;
-	}
+	tick_nohz_program_next_event();
 
 	raise_softirq(SOFTIRQ_TIMER);
 }
 
+/*
+ * Jiffies are derived from the free running counter, so they are caught up
+ * right away after a cpu slept without ticks.
+ */
 uint64_t get_tick(void)
 {
-	return tick;
+	return get_cycles() / TICK_TIMER_COUNT;
+}
+
+void dump_tick_stats(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("cpu%d: tick_stopped=%d, nohz_sleeps=%d\n",
+		       i, per_cpu(tick_stopped, i), per_cpu(nohz_sleeps, i));
+	}
 }
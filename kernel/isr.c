@@ -14,6 +14,13 @@
 #include <softirq.h>
 #include <time.h>
 #include <wait.h>
+#include <preempt.h>
+#include <smp.h>
+#include <cputime.h>
+#include <resource.h>
+#include <waitstatus.h>
+#include <fpsimd.h>
+#include <mmu_context.h>
 
 DEFINE_PER_CPU(uint64_t[MAX_NUM_INTERRUPTS], irq_trigger_count);
 
@@ -28,7 +35,7 @@ static void handle_rtc_irq(void)
 }
 
 isr_func_t isr_func[MAX_NUM_INTERRUPTS] = {
-	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	handle_ipi_reschedule, handle_ipi_call_function, handle_ipi_work, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, handle_timer_irq, NULL,
@@ -72,6 +79,11 @@ static int is_kernel_data_abort(uint64_t esr)
 	return (get_ec_from_esr(esr) == 0x25);
 }
 
+static int is_fpsimd_access(uint64_t esr)
+{
+	return (get_ec_from_esr(esr) == 0x07);
+}
+
 static int is_svc(uint64_t esr)
 {
 	return (get_ec_from_esr(esr) == 0x15);
@@ -89,8 +101,101 @@ static void show_esr(uint64_t esr)
 	printk("Instruction specific syndrome: 0X%x\n", (esr & 0xFFFFFF));
 }
 
+static int is_permission_fault(uint64_t esr)
+{
+	/* Data fault status code, of any level. */
+	return ((esr & 0x3C) == 0x0C);
+}
+
+static int is_write_abort(uint64_t esr)
+{
+	/* WnR */
+	return ((esr >> 6) & 0x1);
+}
+
+/*
+ * A fault of current on a user address: the pages of private VMAs are
+ * allocated zeroed on their first write, reads until then see the zero
+ * page. A page shared since a fork is copied on its first write. Returns -1
+ * if the access isn't allowed or memory ran out, the fault isn't retried.
+ */
+static int do_page_fault(unsigned long addr, uint64_t esr)
+{
+	struct task_struct *current = get_current_proc();
+	struct vm_area_struct *vma;
+	uint64_t *page;
+	int ret;
+
+	if (current->mm == NULL) {
+		return -1;
+	}
+
+	spin_lock(&current->mm->page_table_lock);
+	vma = find_vma(current->mm, addr);
+	if (vma == NULL) {
+		spin_unlock(&current->mm->page_table_lock);
+		return -1;
+	}
+
+	if (is_permission_fault(esr)) {
+		if (!is_write_abort(esr) || !(vma->vm_flags & VM_WRITE)
+		    || (vma->vm_flags & VM_SHARED)) {
+			spin_unlock(&current->mm->page_table_lock);
+			return -1;
+		}
+		ret = do_wp_page(current->mm, current->pg_dir, vma, addr);
+		spin_unlock(&current->mm->page_table_lock);
+		return ret;
+	}
+
+	/* Another thread of the mm may have faulted it in meanwhile. */
+	if (user_page_mapped(current->pg_dir, PAGE_ADDR(addr))) {
+		spin_unlock(&current->mm->page_table_lock);
+		return 0;
+	}
+	if (!is_write_abort(esr) && !(vma->vm_flags & VM_SHARED)) {
+		setup_user_page_mapping(current->pg_dir, (void *)PAGE_ADDR(addr),
+					__pa(empty_zero_page), PAGE_SIZE, true);
+		spin_unlock(&current->mm->page_table_lock);
+		return 0;
+	}
+	page = get_zeroed_pages(0);
+	if (page == NULL) {
+		spin_unlock(&current->mm->page_table_lock);
+		printk("get_zeroed_pages failed\n");
+		return -1;
+	}
+	ret = add_pages_block(vma, (void *)PAGE_ADDR(addr), page, 0);
+	if (ret < 0) {
+		spin_unlock(&current->mm->page_table_lock);
+		free_pages(page, 0);
+		printk("add pages block to vma failed\n");
+		return -1;
+	}
+	setup_user_page_mapping(current->pg_dir, (void *)PAGE_ADDR(addr),
+				__pa(page), PAGE_SIZE, false);
+	spin_unlock(&current->mm->page_table_lock);
+
+	return 0;
+}
+
 void do_el1_sync(uint64_t addr, uint64_t esr, struct pt_regs *regs)
 {
+	/* Keep the I bit the faulting code ran with. */
+	if (!(regs->pstate & 0x80)) {
+		enable_irq();
+	}
+
+	/*
+	 * The kernel writes e.g. the results of system calls to user memory,
+	 * never with irqs off: the fault takes page_table_lock, whose holder
+	 * may wait for a cross call to this cpu.
+	 */
+	if (is_kernel_data_abort(esr) && addr < PAGE_OFFSET &&
+	    !(regs->pstate & 0x80) && do_page_fault(addr, esr) == 0) {
+		return;
+	}
+
 	printk("cpu%d El1 sync exception.\n", get_cpu_core_id());
 	printk("addr=%p\n", (void *)addr);
 	show_esr(esr);
@@ -107,7 +212,8 @@ void irq_handler(struct pt_regs *regs)
 	int core_id;
 
 	reg_GICC_IAR = *(uint32_t *)__va(VIRT_GIC_CPU_BASE + 0x0C);
-	irq = reg_GICC_IAR;
+	/* Bits 10-12 hold the source cpu of an SGI. */
+	irq = reg_GICC_IAR & 0x3FF;
 
 	core_id = get_cpu_core_id();
 
@@ -116,6 +222,7 @@ void irq_handler(struct pt_regs *regs)
 		return;
 	}
 
+	irq_enter();
 	if (irq < MAX_NUM_INTERRUPTS) {
 		if (isr_func[irq] != NULL) {
 			per_cpu(irq_trigger_count, core_id)[irq]++;
@@ -126,80 +233,75 @@ void irq_handler(struct pt_regs *regs)
 	} else {
 		printk("cpu%d: irq out of range: %d\n", core_id, irq);
 	}
-	*(uint32_t *)__va(VIRT_GIC_CPU_BASE + 0x10) = irq;
+	*(uint32_t *)__va(VIRT_GIC_CPU_BASE + 0x10) = reg_GICC_IAR;
 
 	if (irq == IRQ_TIMER) {
-		struct task_struct *current = get_current_proc();
-		int in_user_mode = user_mode(regs);
-		if (in_user_mode) {
-			current->utime += 1;
-		} else {
-			current->stime += 1;
-		}
-		if (in_user_mode || current->pid == 0) {
-			enable_irq();
+		scheduler_tick();
+	}
+	irq_exit();
+
+	/* Preemption point on the way back to the interrupted context. */
+	if (need_resched()) {
 #ifdef DEBUG_SCHED
-			printk("Showing pt_regs before schedule\n");
-			show_pt_regs(regs);
+		printk("Showing pt_regs before schedule\n");
+		show_pt_regs(regs);
 #endif
+		if (user_mode(regs)) {
+			enable_irq();
 			schedule();
-#ifdef DEBUG_SCHED
-			printk("Showing pt_regs after schedule\n");
-			show_pt_regs(regs);
-#endif
 			disable_irq();
+		} else {
+			preempt_schedule_irq();
 		}
+#ifdef DEBUG_SCHED
+		printk("Showing pt_regs after schedule\n");
+		show_pt_regs(regs);
+#endif
 	}
-	do_softirq();
 }
 
-static void sys_fork(struct pt_regs *regs)
+/*
+ * Gives child a copy of the address space of parent. The private pages are
+ * shared read-only and copied on their first write, see do_wp_page(), fork
+ * doesn't copy any data. The mm of parent is locked, its other threads can't
+ * change it meanwhile.
+ */
+static int copy_mm(struct task_struct *parent_task,
+		   struct task_struct *child_task)
 {
-	struct task_struct *parent_task = get_current_proc();
-	struct task_struct *child_task;
 	uint64_t *pg_dir_user_map;
 	struct mm_struct *mm;
 
-#ifdef DEBUG_FORK
-	printk("In sys_fork\n");
-#endif
-
-	child_task = get_task_slot();
-	if (child_task == NULL) {
-		goto fail_child_task;
-	}
-
-	memcpy(child_task->stack, parent_task->stack, PAGE_SIZE);
-	((struct thread_info *)(child_task->stack))->task = child_task;
-
-	memcpy(&child_task->thread, &parent_task->thread,
-	       sizeof (struct thread_struct));
-
-	strncpy(child_task->comm, parent_task->comm, (TASK_COMM_LEN - 1));
-
-	mm = kzalloc(sizeof (*mm));
+	mm = mm_alloc();
 	if (mm == NULL) {
 		printk("Memory allocation for mm_struct failed\n");
-		goto fail_mm_alloc;
+		return -1;
 	}
 	child_task->mm = mm;
 
 	pg_dir_user_map = get_zeroed_pages(0);
 	if (pg_dir_user_map == NULL) {
 		printk("Memory allocation for user page directory failed\n");
-		goto fail_pg_dir_user_map;
+		return -1;
 	}
 	child_task->pg_dir = pg_dir_user_map;
 #ifdef DEBUG_FORK
 	printk("child_task->pg_dir=%p\n", child_task->pg_dir);
 #endif
 
+	spin_lock(&parent_task->mm->page_table_lock);
 	for (struct vm_area_struct *vma = parent_task->mm->mmap; vma != NULL; vma = vma->vm_next) {
-		uint64_t *page;
 		struct vm_area_struct *child_vma;
-		unsigned int order;
 		int ret;
 
+		/* The stacks of the other threads: they don't run in child. */
+		if (vma->vm_start >= USER_THREAD_STACKS_START &&
+		    vma->vm_start < USER_THREAD_STACKS_START +
+		    MAX_USER_THREAD_STACKS * USER_THREAD_STACK_SIZE &&
+		    vma->vm_start != parent_task->thread_stack) {
+			continue;
+		}
+
 		if (vma->vm_flags & VM_SHARED) {
 			ret = setup_vma(child_task, vma->vm_start, vma->vm_end,
 				  vma->vm_flags, vma->lma);
@@ -207,36 +309,7 @@ static void sys_fork(struct pt_regs *regs)
 				printk("setup_vma failed\n");
 				goto fail_setup_vma;
 			}
-		} else if (vma->lma != (unsigned long)(-1)) {
-			order = get_order(vma->vm_end - vma->vm_start);
-			page = get_free_pages(order);
-			if (page == NULL) {
-				printk("sys_fork get_free_pages failed\n");
-				goto fail_setup_vma;
-			}
-			ret = setup_vma(child_task, vma->vm_start, vma->vm_end,
-				  vma->vm_flags, (unsigned long)__pa(page));
-			if (ret < 0) {
-				free_pages(page, order);
-				printk("setup_vma failed\n");
-				goto fail_setup_vma;
-			}
-			child_vma = find_vma(child_task->mm, vma->vm_start);
-			ret = add_pages_block(child_vma, (void *)vma->vm_start, page, order);
-			if (ret < 0) {
-				printk("sys_fork add pages block to vma failed\n");
-				free_pages(page, order);
-				goto fail_setup_vma;
-			}
-#ifdef DEBUG_FORK
-			printk("Copying parent_vma=%p, vma->vm_start=%p, "
-			       "vma->vm_end=%p\n",
-			       vma, vma->vm_start, vma->vm_end);
-#endif
-			memcpy(page, (void *)vma->vm_start,
-			       (vma->vm_end - vma->vm_start));
 		} else {
-			struct pages_block *pb;
 			ret = setup_vma(child_task, vma->vm_start, vma->vm_end,
 				  vma->vm_flags, (unsigned long)(-1));
 			if (ret < 0) {
@@ -245,56 +318,139 @@ static void sys_fork(struct pt_regs *regs)
 			}
 			child_vma = find_vma(child_task->mm, vma->vm_start);
 #ifdef DEBUG_FORK
-			printk("Copying parent_vma=%p\n", vma);
+			printk("Sharing parent_vma=%p\n", vma);
 #endif
-			list_for_each_entry(pb, &vma->pages_block_list, list) {
-				order = 0;
-				page = get_free_pages(order);
-				if (page == NULL) {
-					printk("sys_fork get_free_pages failed\n");
-					goto fail_setup_vma;
-				}
-				ret = add_pages_block(child_vma, pb->user_virt_addr, page, order);
-				if (ret < 0) {
-					printk("sys_fork add pages block to vma failed\n");
-					free_pages(page, order);
-					goto fail_setup_vma;
-				}
-				memcpy(page, pb->linear_addr,
-				       (PAGE_SIZE * (1 << order)));
+			ret = copy_page_range(ASID(parent_task->mm),
+					      child_task->pg_dir,
+					      parent_task->pg_dir, child_vma, vma);
+			if (ret < 0) {
+				printk("copy_page_range failed\n");
+				goto fail_setup_vma;
 			}
 		}
 	}
+	child_task->mm->start_brk = parent_task->mm->start_brk;
+	child_task->mm->brk = parent_task->mm->brk;
+	if (parent_task->thread_stack != 0) {
+		/* child runs on the copy of the stack of the forking thread. */
+		__set_bit((parent_task->thread_stack - USER_THREAD_STACKS_START) /
+			  USER_THREAD_STACK_SIZE, child_task->mm->thread_stacks);
+		child_task->thread_stack = parent_task->thread_stack;
+	}
+	/* The pages of parent are read-only from now on. */
+	invalidate_tlb_by_asid(ASID(parent_task->mm));
+	spin_unlock(&parent_task->mm->page_table_lock);
 #ifdef DEBUG_FORK
 	dump_vmas(child_task);
 #endif
 	setup_user_page_mappings(child_task);
 
-	child_task->mm->start_brk = parent_task->mm->start_brk;
-	child_task->mm->brk = parent_task->mm->brk;
+	return 0;
+
+fail_setup_vma:
+	invalidate_tlb_by_asid(ASID(parent_task->mm));
+	spin_unlock(&parent_task->mm->page_table_lock);
+	return -1;
+}
+
+/*
+ * The child of fork() gets a copy of the address space, the one of clone()
+ * with CLONE_VM shares it. A thread runs on newsp, or on a stack of its own
+ * if newsp is 0. Returns the pid of the child, -1 on failure.
+ */
+static long do_fork(struct pt_regs *regs, unsigned long clone_flags,
+		    unsigned long newsp, unsigned long tls)
+{
+	struct task_struct *parent_task = get_current_proc();
+	struct task_struct *child_task;
+	struct pt_regs *child_regs;
+
+#ifdef DEBUG_FORK
+	printk("In do_fork, clone_flags=%x\n", clone_flags);
+#endif
+
+	child_task = get_task_slot();
+	if (child_task == NULL) {
+		return -1;
+	}
+	link_child(parent_task, child_task);
+
+	memcpy(child_task->stack, parent_task->stack, PAGE_SIZE);
+	((struct thread_info *)(child_task->stack))->task = child_task;
+
+	fpsimd_preserve_current_state();
+	parent_task->thread.tp_value = read_reg(TPIDR_EL0);
+	memcpy(&child_task->thread, &parent_task->thread,
+	       sizeof (struct thread_struct));
+	fpsimd_flush_task_state(child_task);
+	if (clone_flags & CLONE_SETTLS) {
+		child_task->thread.tp_value = tls;
+	}
+
+	strncpy(child_task->comm, parent_task->comm, (TASK_COMM_LEN - 1));
+
+	if (clone_flags & CLONE_VM) {
+		mmget(parent_task->mm);
+		child_task->mm = parent_task->mm;
+		child_task->pg_dir = parent_task->pg_dir;
+	} else if (copy_mm(parent_task, child_task) < 0) {
+		goto fail_mm;
+	}
 
 	child_task->thread.cpu_context.pc = (u64)child_returns_from_fork;
 	child_task->thread.cpu_context.sp = (u64)child_task->stack
 		+ (u64)IN_PAGE_OFFSET(regs);
-	((struct pt_regs *)(child_task->thread.cpu_context.sp))->regs[0] = 0;
+	child_regs = (struct pt_regs *)(child_task->thread.cpu_context.sp);
+	child_regs->regs[0] = 0;
 
-	child_task->state = RUNNING;
+	if (newsp == 0 && (clone_flags & CLONE_VM)) {
+		newsp = alloc_thread_stack(child_task);
+		if (newsp == 0) {
+			goto fail_mm;
+		}
+	}
+	if (newsp != 0) {
+		child_regs->sp = newsp;
+	}
+
+	child_task->cpus_allowed = parent_task->cpus_allowed;
+	child_task->policy = parent_task->policy;
+	child_task->rt_priority = parent_task->rt_priority;
+	sched_fork(child_task);
+	set_task_state(child_task, RUNNING);
 
-	regs->regs[0] = child_task->pid;
 #ifdef DEBUG_FORK
-	printk("regs->regs[0]=%d\n", regs->regs[0]);
+	printk("child pid=%d\n", child_task->pid);
 #endif
 
-	return;
+	return child_task->pid;
 
-fail_setup_vma:
-fail_pg_dir_user_map:
-	exit_mm(child_task);
-fail_mm_alloc:
-fail_child_task:
+fail_mm:
+	if (child_task->mm != NULL) {
+		exit_mm(child_task);
+	}
 	free_task_slot(child_task);
 
-	regs->regs[0] = -1;
+	return -1;
+}
+
+static void sys_fork(struct pt_regs *regs)
+{
+	regs->regs[0] = do_fork(regs, 0, 0, 0);
+}
+
+static void sys_clone(struct pt_regs *regs)
+{
+	unsigned long clone_flags = regs->regs[0];
+	unsigned long newsp = regs->regs[1];
+	unsigned long tls = regs->regs[2];
+
+	if ((clone_flags & ~(CLONE_VM | CLONE_SETTLS)) != 0) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	regs->regs[0] = do_fork(regs, clone_flags, newsp, tls);
 }
 
 static void sys_brk(struct pt_regs *regs)
@@ -306,6 +462,7 @@ static void sys_brk(struct pt_regs *regs)
 	struct vm_area_struct *vma;
 	int ret_val;
 
+	spin_lock(&current->mm->page_table_lock);
 	if (addr == 0) {
 		goto out;
 	}
@@ -324,7 +481,7 @@ static void sys_brk(struct pt_regs *regs)
 		struct pages_block *pb;
 		struct pages_block *pb_dummy;
 
-		ret_val = unmap_user_page_mapping(current->pid, current->pg_dir,
+		ret_val = unmap_user_page_mapping(ASID(current->mm), current->pg_dir,
 						  (void *)newbrk,
 						  (oldbrk - newbrk));
 		if (ret_val < 0) {
@@ -338,7 +495,7 @@ static void sys_brk(struct pt_regs *regs)
 				printk("%s: deleting pages_block user_virt_addr=%p, linear_addr=%p, order=%d\n",
 				       __FUNCTION__, pb->user_virt_addr, pb->linear_addr, pb->order);
 #endif
-				list_del(&pb->list);
+				del_pages_block(pb);
 			}
 		}
 	}
@@ -354,6 +511,7 @@ out:
 		vma->vm_end = current->mm->brk;
 	}
 	regs->regs[0] = current->mm->brk;
+	spin_unlock(&current->mm->page_table_lock);
 #ifdef DEBUG_BRK
 	printk("current->mm->brk=%p\n", current->mm->brk);
 #endif
@@ -417,6 +575,7 @@ static ssize_t read_stdin(uint8_t *buf, size_t count)
 
 	struct wait_queue_entry read_wq_entry;
 	struct task_struct *current = get_current_proc();
+	uint8_t line[UART_IN_BUF_LEN];
 	int copy_len;
 	unsigned long flags;
 
@@ -442,10 +601,13 @@ static ssize_t read_stdin(uint8_t *buf, size_t count)
 		return -1;
 	}
 	copy_len = uib_index;
-	memcpy(buf, uart_in_buf, copy_len);
+	memcpy(line, uart_in_buf, copy_len);
 	uib_index = 0;
 	spin_unlock_irqrestore(&uib_lock, flags);
 
+	/* buf may fault, not with irqs off, see do_el1_sync(). */
+	memcpy(buf, line, copy_len);
+
 	return copy_len;
 }
 
@@ -486,9 +648,123 @@ static void sys_write(struct pt_regs *regs)
 	regs->regs[0] = ret;
 }
 
+/*
+ * pid 0 is the calling process. Only for reads: the task may exit and its
+ * task_struct be reused for another pid meanwhile, see sched_setaffinity().
+ */
+static struct task_struct *find_task_by_pid(int pid)
+{
+	struct task_struct *t;
+
+	if (pid == 0) {
+		return get_current_proc();
+	}
+
+	t = pid_to_task(pid);
+	if (t == NULL || !t->in_use || t->state == STOPPED || t->state == ZOMBIE) {
+		return NULL;
+	}
+
+	return t;
+}
+
+static void sys_sched_setaffinity(struct pt_regs *regs)
+{
+	int pid = (int)regs->regs[0];
+	size_t cpusetsize = (size_t)regs->regs[1];
+	const cpumask_t *mask = (const cpumask_t *)regs->regs[2];
+
+	if (mask == NULL || cpusetsize < sizeof (cpumask_t)) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	regs->regs[0] = sched_setaffinity(pid, *mask);
+}
+
+static void sys_sched_getaffinity(struct pt_regs *regs)
+{
+	int pid = (int)regs->regs[0];
+	size_t cpusetsize = (size_t)regs->regs[1];
+	cpumask_t *mask = (cpumask_t *)regs->regs[2];
+	struct task_struct *t;
+
+	if (mask == NULL || cpusetsize < sizeof (cpumask_t)) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	t = find_task_by_pid(pid);
+	if (t == NULL) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	/* Like Linux, only the kernel's mask is written, its size is returned. */
+	*mask = t->cpus_allowed;
+	regs->regs[0] = sizeof (cpumask_t);
+}
+
+static void sys_sched_setscheduler(struct pt_regs *regs)
+{
+	int pid = (int)regs->regs[0];
+	int policy = (int)regs->regs[1];
+	const struct sched_param *param = (const struct sched_param *)regs->regs[2];
+
+	if (param == NULL) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	regs->regs[0] = do_sched_setscheduler(pid, policy, param);
+}
+
+static void sys_sched_getscheduler(struct pt_regs *regs)
+{
+	int pid = (int)regs->regs[0];
+	struct task_struct *t;
+
+	t = find_task_by_pid(pid);
+	if (t == NULL) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	regs->regs[0] = t->policy;
+}
+
+static void sys_getrusage(struct pt_regs *regs)
+{
+	int who = (int)regs->regs[0];
+	struct rusage *ru = (struct rusage *)regs->regs[1];
+
+	if (who != RUSAGE_SELF || ru == NULL) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	task_rusage(get_current_proc(), ru);
+	regs->regs[0] = 0;
+}
+
+static void sys_wait4(struct pt_regs *regs)
+{
+	int pid = (int)regs->regs[0];
+	int *status = (int *)regs->regs[1];
+	int options = (int)regs->regs[2];
+	struct rusage *ru = (struct rusage *)regs->regs[3];
+
+	if (pid == 0 || pid < -1 || (options & ~WNOHANG) != 0) {
+		regs->regs[0] = -1;
+		return;
+	}
+
+	regs->regs[0] = do_wait(pid, status, options, ru);
+}
+
 static syscall_func_t syscall_func[MAX_NUM_SYSCALLS] = {
-	sys_fork, sys_brk, sys_exit, sys_nanosleep, sys_pause, sys_read, sys_write, NULL,
-	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	sys_fork, sys_brk, sys_exit, sys_nanosleep, sys_pause, sys_read, sys_write, sys_sched_setaffinity,
+	sys_sched_getaffinity, sys_sched_setscheduler, sys_sched_getscheduler, sys_getrusage, sys_wait4, sys_clone, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
@@ -499,12 +775,6 @@ static syscall_func_t syscall_func[MAX_NUM_SYSCALLS] = {
 
 void do_el0_sync(uint64_t addr, uint64_t esr, struct pt_regs *regs)
 {
-	uint64_t *page;
-	struct task_struct *current = get_current_proc();
-	struct vm_area_struct *vma;
-	unsigned int order;
-	int ret;
-
 	if (is_svc(esr)) {
 		regs->orig_x0 = regs->regs[0];
 		regs->syscallno = regs->regs[8];
@@ -528,22 +798,12 @@ void do_el0_sync(uint64_t addr, uint64_t esr, struct pt_regs *regs)
 		return;
 	}
 
-	vma = find_vma(current->mm, addr);
-	if (vma != NULL) {
-		order = 0;
-		page = get_free_pages(order);
-		if (page == NULL) {
-			printk("get_free_pages failed\n");
-			return;
-		}
-		setup_user_page_mapping(current->pg_dir,
-					(void *)PAGE_ADDR(addr),
-					__pa(page), PAGE_SIZE, false);
-		ret = add_pages_block(vma, (void *)PAGE_ADDR(addr), page, order);
-		if (ret < 0) {
-			printk("add pages block to vma failed\n");
-		}
+	if (is_fpsimd_access(esr)) {
+		do_fpsimd_acc();
+		return;
+	}
 
+	if (do_page_fault(addr, esr) == 0) {
 		return;
 	}
 
@@ -13,6 +13,12 @@
 #include <user_init.h>
 #include <timer.h>
 #include <mutex.h>
+#include <smp.h>
+#include <cputime.h>
+#include <fpsimd.h>
+#include <mmu_context.h>
+#include <workqueue.h>
+#include <slab.h>
 
 #define IN_KERNEL
 #include <test_mem_alloc.h>
@@ -124,19 +130,6 @@ static void config_rtc(void)
 	*(unsigned int *)__va(VIRT_RTC_RTCIMSC) = 1;	/* Interrupt */
 }
 
-static int kernel_init(void *p)
-{
-	while (true) {
-#ifdef DEBUG_KERNEL_THREAD
-		printk("Running in init%d\n", p);
-#endif
-		start_uart_tx();
-		msleep(100);
-	}
-
-	return 0;
-}
-
 static int kernel_exit(void *p)
 {
 	printk("%s: arg=%p\n", __FUNCTION__, p);
@@ -345,7 +338,7 @@ static int user_test(char *p)
 
 	setup_user_page_mappings(current);
 
-	write_ttbr0_el1((u64)__pa(current->pg_dir), current->pid);
+	activate_mm(current);
 	printk("Setting userspace TTBR0_EL1=%p\n", read_reg(TTBR0_EL1));
 	printk("First instruction at userspace: %x\n", *(uint32_t *)vma_user);
 
@@ -426,10 +419,14 @@ void main(void)
 
 	clear_linear_bss();
 
+	init_page_alloc();
+	kmem_cache_init();
 	init_printk();
 	init_uart();
 	init_sched();
+	init_asids();
 	init_timer_module();
+	init_workqueues();
 
 #ifdef DEBUG_GIC
 	printk("distributor interrupts cpu targets:\n");
@@ -447,6 +444,9 @@ void main(void)
 	enable_dist_int_send(VIRT_GIC_DIST_BASE);
 
 	config_gic_cpu();
+	init_vtime();
+	fpsimd_init_cpu();
+	init_ipi();
 	enable_irq();
 
 	config_rtc();
@@ -536,12 +536,13 @@ void main(void)
 
 	init_kmalloc_free();
 
-	ret = kernel_thread("init", kernel_init, NULL);
+	/* The workers drain the log, printk() has queued the work. */
+	ret = create_workers();
 	if (ret < 0) {
 		return;
 	}
 
-	ret = kernel_thread("init2", kernel_init, (void *)2);
+	ret = create_kzerod();
 	if (ret < 0) {
 		return;
 	}
@@ -621,6 +622,9 @@ void main_secondary_cpu(void)
 		    0 /* unused for PPI */ );
 
 	config_gic_cpu();
+	init_vtime();
+	fpsimd_init_cpu();
+	init_ipi();
 	enable_irq();
 
 	config_hw_timer();
@@ -3,6 +3,7 @@
 #include <printk.h>
 #include <hardware.h>
 #include <hw_timer.h>
+#include <sched.h>
 
 extern char KERNEL_LINEAR_START[];
 
@@ -61,13 +62,28 @@ void dump_stack(void)
 	local_irq_restore(flags);
 }
 
+/*
+ * The idle loop. The next timer event is programmed with irqs disabled, so
+ * that a wakeup can't slip in between; wfi returns on a pending irq even if
+ * it's masked.
+ */
 void cpu_idle(void)
 {
-	asm volatile (
-		      "loop_idle:\n\t"
-		      "wfi\n\t"
-		      "b loop_idle\n\t"
-		      );
+	int cpu;
+
+	while (true) {
+		disable_irq();
+		cpu = get_cpu_core_id();
+		if (nr_running_cpu(cpu) == 0) {
+			tick_nohz_program_next_event();
+			asm volatile ("wfi");
+		}
+		enable_irq();
+
+		if (nr_running_cpu(cpu) > 0) {
+			schedule();
+		}
+	}
 }
 
 struct timestamp get_timestamp(void)
@@ -11,11 +11,18 @@ void init_mutex(mutex_t *p)
 
 	spin_lock_init(&p->lock);
 	p->state = MUTEX_UNLOCKED;
-	p->waiting = 0;
+	INIT_LIST_HEAD(&p->wait_list);
 }
 
+struct mutex_waiter {
+	struct list_head list;
+	struct task_struct *task;
+};
+
 void mutex_lock(mutex_t *p)
 {
+	struct mutex_waiter waiter;
+
 	if (p == NULL) {
 		printk("%s: lock is null\n", __FUNCTION__);
 		return;
@@ -31,7 +38,9 @@ void mutex_lock(mutex_t *p)
 		} else {
 			struct task_struct *current = get_current_proc();
 
-			p->waiting |= (1ULL << (unsigned int)current->pid);
+			/* mutex_unlock() takes the waiter off the list. */
+			waiter.task = current;
+			list_add_tail(&waiter.list, &p->wait_list);
 			set_task_state(current, SLEEPING);
 			spin_unlock(&p->lock);
 			schedule();
@@ -39,23 +48,9 @@ void mutex_lock(mutex_t *p)
 	}
 }
 
-static int get_next_waiting(mutex_t *m)
-{
-	int i;
-	static int max_pid = ((sizeof (m->waiting)) * 8);
-
-	for (i = 0; i < max_pid; i++) {
-		if ((m->waiting & (1ULL << (unsigned int)i)) != 0) {
-			return i;
-		}
-	}
-
-	return -1;
-}
-
 void mutex_unlock(mutex_t *p)
 {
-	int pid;
+	struct mutex_waiter *waiter;
 
 	if (p == NULL) {
 		printk("%s: lock is null\n", __FUNCTION__);
@@ -64,10 +59,11 @@ void mutex_unlock(mutex_t *p)
 
 	spin_lock(&p->lock);
 	p->state = MUTEX_UNLOCKED;
-	pid = get_next_waiting(p);
-	if (pid > 0) {
-		p->waiting &= ~(1ULL << (unsigned int)pid);
-		set_task_state(pid_to_task(pid), RUNNING);
+	if (!list_empty(&p->wait_list)) {
+		waiter = list_first_entry(&p->wait_list, struct mutex_waiter,
+					  list);
+		list_del(&waiter->list);
+		set_task_state(waiter->task, RUNNING);
 	}
 	spin_unlock(&p->lock);
 }
@@ -8,6 +8,9 @@
 #include <print.h>
 #include <memory.h>
 #include <percpu.h>
+#include <preempt.h>
+#include <smp.h>
+#include <workqueue.h>
 
 #define LOG_BUF_SIZE 0x1000000
 static char *__log_buf;
@@ -18,6 +21,46 @@ DEFINE_PER_CPU(int, tmp_printk_offset);
 
 struct concurrent_cbuf kernel_log;
 
+#ifdef UART_IRQ_MODE
+/* The uart irq is routed to cpu0, the drain work runs there too. */
+#define LOG_DRAIN_CPU 0
+
+static struct work_struct log_drain_work;
+static DEFINE_PER_CPU(int, log_kick_pending);
+
+static void log_drain_work_fn(struct work_struct *work)
+{
+	start_uart_tx();
+}
+
+/*
+ * printk() may be called with any lock held, a run queue's included, so it
+ * can't wake the worker itself: it interrupts its own cpu, which queues the
+ * drain work once irqs are enabled again.
+ */
+static void wake_up_klogd(int core_id)
+{
+	if (!per_cpu(log_kick_pending, core_id)) {
+		per_cpu(log_kick_pending, core_id) = true;
+		smp_send_work_ipi();
+	}
+}
+
+void printk_ipi_work(void)
+{
+	per_cpu(log_kick_pending, get_cpu_core_id()) = false;
+	queue_work_on(LOG_DRAIN_CPU, &log_drain_work);
+}
+#else
+static void wake_up_klogd(int core_id)
+{
+}
+
+void printk_ipi_work(void)
+{
+}
+#endif
+
 void init_printk(void)
 {
 	__log_buf = get_free_pages(get_order(LOG_BUF_SIZE));
@@ -25,6 +68,9 @@ void init_printk(void)
 		return;
 	}
 	init_concurrent_cbuf(&kernel_log, __log_buf, LOG_BUF_SIZE);
+#ifdef UART_IRQ_MODE
+	INIT_WORK(&log_drain_work, log_drain_work_fn);
+#endif
 }
 
 #ifdef UART_IRQ_MODE
@@ -61,12 +107,15 @@ int printk(const char *fmt, ...)
 	int ret;
 	struct timestamp cur_ts;
 	int num_ts_printed = 0;
-	int core_id = get_cpu_core_id();
+	int core_id;
 
 	if (fmt == NULL) {
 		return 0;
 	}
 
+	/* The message is built in a per-cpu buffer. */
+	preempt_disable();
+	core_id = get_cpu_core_id();
 	per_cpu(tmp_printk_offset, core_id) = 0;
 
 	cur_ts = get_timestamp();
@@ -82,6 +131,8 @@ int printk(const char *fmt, ...)
 
 	ret = write_concurrent_cbuf(&kernel_log, per_cpu(tmp_printk_buf, core_id),
 				    (num_ts_printed + num_printed));
+	wake_up_klogd(core_id);
+	preempt_enable();
 
 	if (ret == 0) {
 		return num_printed;
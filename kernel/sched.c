@@ -9,6 +9,20 @@
 #include <percpu.h>
 #include <timer.h>
 #include <hw_timer.h>
+#include <misc.h>
+#include <rbtree.h>
+#include <softirq.h>
+#include <bitops.h>
+#include <preempt.h>
+#include <smp.h>
+#include <cputime.h>
+#include <fpsimd.h>
+#include <mmu_context.h>
+#include <workqueue.h>
+#include <wait.h>
+#include <resource.h>
+#include <waitstatus.h>
+#include <slab.h>
 
 #include "../mm/page_table.c"
 void *dummy_sched_c = walk_virt_addr;
@@ -16,11 +30,27 @@ void *dummy_sched_c = walk_virt_addr;
 extern struct task_struct *cpu_switch_to(struct task_struct *prev,
 					 struct task_struct *next);
 
+DEFINE_PER_CPU(int, __preempt_count);
+DEFINE_PER_CPU(int, __need_resched);
+
+/* EL0 reads TPIDR_EL0 only after the exception return, no barrier needed. */
+static void tls_thread_switch(struct task_struct *prev,
+			      struct task_struct *next)
+{
+	prev->thread.tp_value = read_reg(TPIDR_EL0);
+	asm volatile ("msr tpidr_el0, %0" : : "r" (next->thread.tp_value));
+}
+
 struct task_struct *__switch_to(struct task_struct *prev,
 				struct task_struct *next)
 {
 	struct task_struct *last;
+	int cpu = get_cpu_core_id();
 
+	prev->preempt_count = per_cpu(__preempt_count, cpu);
+	per_cpu(__preempt_count, cpu) = next->preempt_count;
+	fpsimd_thread_switch(prev, next);
+	tls_thread_switch(prev, next);
 	last = cpu_switch_to(prev, next);
 
 	return last;
@@ -38,15 +68,139 @@ struct task_struct swapper_task_struct[NUM_CPUS] = {
 	}
 };
 
-static uint64_t proc_kernel_stacks[MAX_NUM_PROCESSES][KERNEL_STACK_SIZE/8] __attribute__ \
-		 ((aligned (KERNEL_STACK_SIZE)));
-
+/*
+ * tasks_lock protects all of the below, and the parent links of the tasks.
+ * task_list has every task but the idle ones, zombies included; exited tasks
+ * without a parent move to dead_tasks until reap_work frees them.
+ */
 static struct spinlock tasks_lock;
-static struct task_struct tasks[MAX_NUM_PROCESSES];
+static LIST_HEAD(task_list);
+static LIST_HEAD(dead_tasks);
+static struct delayed_work reap_work;
+
+static void reap_dead_tasks(struct work_struct *work);
+static unsigned int nr_tasks;
+
+/*
+ * Slabs of task_structs are never freed, a stale pointer from pid_to_task()
+ * still points to a task_struct. A free one is all zeros.
+ */
+static struct kmem_cache *task_struct_cachep;
+static struct kmem_cache *mm_cachep;
+static struct kmem_cache *vm_area_cachep;
+static struct kmem_cache *pages_block_cachep;
+
+static DECLARE_BITMAP(pid_map, PID_MAX);
+static int last_pid;
+
+#define PIDHASH_SZ 256
+static struct list_head pid_hash[PIDHASH_SZ];
+
+#define pid_hashfn(pid) ((pid) & (PIDHASH_SZ - 1))
+
+struct cfs_rq {
+	struct rb_root tasks_timeline;
+	struct rb_node *rb_leftmost;
+	struct sched_entity *curr;
+	u64 min_vruntime;
+	unsigned int nr_running;
+};
+
+struct rt_prio_array {
+	DECLARE_BITMAP(bitmap, MAX_RT_PRIO);
+	struct list_head queue[MAX_RT_PRIO];
+};
+
+struct rt_rq {
+	struct rt_prio_array active;
+	unsigned int rt_nr_running;
+};
+
+struct rq;
+
+/*
+ * Scheduling class operations, all called with rq->lock held. The classes
+ * are chained from the most urgent one: rt, then fair. The idle task has no
+ * class, it's picked when no class has a runnable task.
+ */
+struct sched_class {
+	const struct sched_class *next;
+	void (*enqueue_task)(struct rq *rq, struct task_struct *t);
+	void (*dequeue_task)(struct rq *rq, struct task_struct *t);
+	void (*put_prev_task)(struct rq *rq, struct task_struct *prev);
+	struct task_struct *(*pick_next_task)(struct rq *rq);
+	void (*set_curr_task)(struct rq *rq, struct task_struct *t);
+	int (*task_tick)(struct rq *rq);
+};
+
+/*
+ * Per-cpu run queue, it holds only the runnable tasks of the cpu. The lock
+ * is taken with irqs disabled, and it's held across the context switch: the
+ * next task releases it in finish_task_switch().
+ */
+struct rq {
+	struct spinlock lock;
+	int cpu;
+	struct task_struct *curr;
+	struct task_struct *idle;
+	unsigned int nr_running;
+	struct cfs_rq cfs;
+	struct rt_rq rt;
+
+	unsigned long next_balance;	/* In ticks. */
+
+	/* Statistics. */
+	unsigned int nr_switches;
+	u64 idle_stamp;
+	u64 idle_cycles;
+	unsigned int lb_count;		/* Periodic balance passes. */
+	unsigned int lb_imbalanced;	/* Passes that found an imbalance. */
+	unsigned int lb_failed;		/* Imbalanced, but nothing migratable. */
+	unsigned int lb_idle_count;	/* Steal attempts of the idle cpu. */
+	unsigned int lb_pulled;		/* Tasks migrated to this cpu. */
+	unsigned int lb_hot_skipped;	/* Tasks left behind as cache hot. */
+};
+
+static DEFINE_PER_CPU(struct rq, runqueues);
+
+#define cpu_rq(cpu) (&per_cpu(runqueues, (cpu)))
+#define this_rq() cpu_rq(get_cpu_core_id())
+#define task_rq(t) cpu_rq((t)->cpu)
+
+#include "sched_fair.c"
+#include "sched_rt.c"
+
+#define sched_class_highest (&rt_sched_class)
+
+static void run_rebalance(void);
+
+static void task_struct_ctor(void *obj)
+{
+	memset(obj, 0, sizeof (struct task_struct));
+}
+
+static void init_task_caches(void)
+{
+	task_struct_cachep = kmem_cache_create("task_struct",
+					       sizeof (struct task_struct), 0,
+					       SLAB_HWCACHE_ALIGN | SLAB_TYPESAFE,
+					       task_struct_ctor);
+	mm_cachep = kmem_cache_create("mm_struct", sizeof (struct mm_struct),
+				      0, SLAB_HWCACHE_ALIGN, NULL);
+	vm_area_cachep = kmem_cache_create("vm_area_struct",
+					   sizeof (struct vm_area_struct), 0, 0,
+					   NULL);
+	pages_block_cachep = kmem_cache_create("pages_block",
+					       sizeof (struct pages_block), 0, 0,
+					       NULL);
+	assert(task_struct_cachep != NULL && mm_cachep != NULL &&
+	       vm_area_cachep != NULL && pages_block_cachep != NULL);
+}
 
 void init_sched(void)
 {
 	int i;
+	struct rq *rq;
 
 	for (i = 0; i < NUM_CPUS; i++) {
 		swapper_task_struct[i].state = RUNNING;
@@ -54,11 +208,41 @@ void init_sched(void)
 		*(uint64_t *)swapper_task_struct[i].stack = (uint64_t)&swapper_task_struct[i];
 		swapper_task_struct[i].pid = 0;
 		swapper_task_struct[i].in_use = true;
+		swapper_task_struct[i].cpu = i;
+		swapper_task_struct[i].on_cpu = true;
+		swapper_task_struct[i].cpus_allowed = (cpumask_t)1 << i;
+		swapper_task_struct[i].policy = SCHED_NORMAL;
+		swapper_task_struct[i].prio = NORMAL_PRIO;
 		strncpy(swapper_task_struct[i].comm, "swapper", TASK_COMM_LEN-1);
 		swapper_task_struct[i].comm[TASK_COMM_LEN-1] = '\0';
+
+		rq = cpu_rq(i);
+		spin_lock_init(&rq->lock);
+		rq->cpu = i;
+		rq->idle_stamp = get_cycles();
+		rq->curr = &swapper_task_struct[i];
+		rq->idle = &swapper_task_struct[i];
+		rq->nr_running = 0;
+		init_cfs_rq(&rq->cfs);
+		init_rt_rq(&rq->rt);
 	}
 
 	spin_lock_init(&tasks_lock);
+	INIT_DELAYED_WORK(&reap_work, reap_dead_tasks);
+	for (i = 0; i < PIDHASH_SZ; i++) {
+		INIT_LIST_HEAD(&pid_hash[i]);
+	}
+	__set_bit(0, pid_map);
+
+	init_task_caches();
+
+	open_softirq(SOFTIRQ_SCHED, run_rebalance);
+}
+
+/* Runnable tasks of the cpu, the running one included. Racy read. */
+unsigned int nr_running_cpu(int cpu)
+{
+	return cpu_rq(cpu)->nr_running;
 }
 
 struct task_struct *get_current_proc(void)
@@ -68,54 +252,456 @@ struct task_struct *get_current_proc(void)
 	return ti->task;
 }
 
-static int is_task_ready(const struct task_struct *t)
+/* rq->lock must be held. */
+static void enqueue_task(struct rq *rq, struct task_struct *t)
+{
+	if (t->on_rq) {
+		return;
+	}
+
+	t->sched_class->enqueue_task(rq, t);
+	t->on_rq = true;
+	rq->nr_running++;
+	if (rq->nr_running > 1) {
+		if (rq->cpu == get_cpu_core_id()) {
+			tick_nohz_restart();
+		} else if (tick_nohz_stopped(rq->cpu)) {
+			smp_send_reschedule(rq->cpu);
+		}
+	}
+}
+
+/* Preempt the running task of cpu, the rq lock of cpu is held. */
+static void resched_cpu(int cpu)
 {
-	return (t->in_use == true && t->state == RUNNING);
+	if (cpu == get_cpu_core_id()) {
+		set_need_resched();
+	} else {
+		per_cpu(__need_resched, cpu) = true;
+		smp_send_reschedule(cpu);
+	}
 }
 
-static struct task_struct *get_next_proc(void)
+/* rq->lock must be held. */
+static void dequeue_task(struct rq *rq, struct task_struct *t)
 {
-	unsigned long flags;
-	int core_id = get_cpu_core_id();
-	u64 min_time;
-	int min_time_index = -1;
+	if (!t->on_rq) {
+		return;
+	}
 
-	flags = spin_lock_irqsave(&tasks_lock);
+	t->sched_class->dequeue_task(rq, t);
+	t->on_rq = false;
+	rq->nr_running--;
+}
 
-	for (int i = core_id; i < MAX_NUM_PROCESSES; i += NUM_CPUS) {
-		if (is_task_ready(&tasks[i])) {
-			u64 proc_time = tasks[i].stime + tasks[i].utime;
-			if (min_time_index == -1 || min_time > proc_time) {
-				min_time_index = i;
-				min_time = proc_time;
-			}
+/*
+ * Lock the run queue the task belongs to, t->cpu may change while we are
+ * spinning on the lock.
+ */
+static struct rq *task_rq_lock(struct task_struct *t, unsigned long *flags)
+{
+	struct rq *rq;
+
+	while (true) {
+		local_irq_save(*flags);
+		rq = task_rq(t);
+		spin_lock(&rq->lock);
+		if (rq == task_rq(t)) {
+			return rq;
 		}
+		spin_unlock(&rq->lock);
+		local_irq_restore(*flags);
 	}
+}
 
-	spin_unlock_irqrestore(&tasks_lock, flags);
-	if (min_time_index >=0) {
-		return &tasks[min_time_index];
+static void task_rq_unlock(struct rq *rq, unsigned long flags)
+{
+	arch_spin_unlock(&rq->lock);
+	local_irq_restore(flags);
+	preempt_enable();
+}
+
+/*
+ * Lock busiest while this_rq->lock is held. The locks are taken in cpu order,
+ * so this_rq->lock may be dropped in between.
+ */
+static void double_lock_balance(struct rq *this_rq, struct rq *busiest)
+{
+	if (busiest->cpu < this_rq->cpu) {
+		spin_unlock(&this_rq->lock);
+		spin_lock(&busiest->lock);
+		spin_lock(&this_rq->lock);
 	} else {
-		return NULL;
+		spin_lock(&busiest->lock);
 	}
 }
 
-void schedule(void)
+/* The task is not queued, and the lock of its current rq is held. */
+static void set_task_cpu(struct task_struct *t, int new_cpu)
+{
+	/* vruntime is relative to the min_vruntime of the queue. */
+	t->se.vruntime -= task_rq(t)->cfs.min_vruntime;
+	t->cpu = new_cpu;
+	t->se.vruntime += task_rq(t)->cfs.min_vruntime;
+}
+
+/* Both locks must be held. */
+static void move_task(struct rq *src, struct rq *dst, struct task_struct *t)
+{
+	dequeue_task(src, t);
+	set_task_cpu(t, dst->cpu);
+	enqueue_task(dst, t);
+}
+
+/* Move up to max_move tasks from busiest to this_rq, both locks are held. */
+static int move_tasks(struct rq *this_rq, struct rq *busiest, int max_move)
+{
+	struct task_struct *t;
+	u64 now = get_cycles();
+	int moved = 0;
+
+	while (moved < max_move) {
+		t = pick_migratable_task_rt(busiest, this_rq->cpu);
+		if (t == NULL) {
+			t = pick_migratable_task_fair(busiest, now,
+						      this_rq->cpu);
+		}
+		if (t == NULL) {
+			break;
+		}
+		move_task(busiest, this_rq, t);
+		this_rq->lb_pulled++;
+		moved++;
+	}
+
+	return moved;
+}
+
+/* The queue with the most runnable tasks, at least min_nr_running of them. */
+static struct rq *find_busiest_queue(struct rq *this_rq,
+				     unsigned int min_nr_running)
+{
+	struct rq *busiest = NULL;
+	unsigned int max_nr_running = min_nr_running - 1;
+	struct rq *rq;
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		rq = cpu_rq(i);
+		if (rq == this_rq) {
+			continue;
+		}
+		/* Racy read, rechecked with the lock held. */
+		if (rq->nr_running > max_nr_running) {
+			max_nr_running = rq->nr_running;
+			busiest = rq;
+		}
+	}
+
+	return busiest;
+}
+
+/*
+ * Called by schedule() when this cpu is about to go idle: steal one waiting
+ * task from the busiest queue. this_rq->lock is held.
+ */
+static void idle_balance(struct rq *this_rq)
+{
+	struct rq *busiest;
+
+	this_rq->lb_idle_count++;
+
+	/* The busiest queue needs a waiting task besides its running one. */
+	busiest = find_busiest_queue(this_rq, 2);
+	if (busiest == NULL) {
+		return;
+	}
+
+	double_lock_balance(this_rq, busiest);
+	if (this_rq->nr_running == 0) {
+		move_tasks(this_rq, busiest, 1);
+	}
+	spin_unlock(&busiest->lock);
+}
+
+/* Periodic pass from SOFTIRQ_SCHED, pull half of the imbalance. */
+static void load_balance(struct rq *this_rq)
+{
+	struct rq *busiest;
+	int imbalance;
+	int moved = 0;
+
+	this_rq->lb_count++;
+
+	busiest = find_busiest_queue(this_rq, this_rq->nr_running + 2);
+	if (busiest == NULL) {
+		return;
+	}
+
+	double_lock_balance(this_rq, busiest);
+	imbalance = ((int)busiest->nr_running - (int)this_rq->nr_running) / 2;
+	if (imbalance > 0) {
+		this_rq->lb_imbalanced++;
+		moved = move_tasks(this_rq, busiest, imbalance);
+		if (moved == 0) {
+			this_rq->lb_failed++;
+		}
+	}
+	spin_unlock(&busiest->lock);
+}
+
+static void run_rebalance(void)
+{
+	unsigned long flags;
+	struct rq *rq;
+
+	local_irq_save(flags);
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	load_balance(rq);
+	spin_unlock(&rq->lock);
+	local_irq_restore(flags);
+}
+
+/* The allowed cpu with the fewest runnable tasks, preferring the current one. */
+static int select_task_rq(cpumask_t cpus_allowed)
+{
+	int best_cpu = get_cpu_core_id();
+	unsigned int min_nr_running = ~0U;
+	int i;
+
+	if (cpumask_test_cpu(best_cpu, cpus_allowed)) {
+		min_nr_running = cpu_rq(best_cpu)->nr_running;
+	}
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		if (cpumask_test_cpu(i, cpus_allowed) &&
+		    cpu_rq(i)->nr_running < min_nr_running) {
+			min_nr_running = cpu_rq(i)->nr_running;
+			best_cpu = i;
+		}
+	}
+
+	return best_cpu;
+}
+
+/*
+ * A task was woken on rq, preempt the running one if it's the idle task or
+ * less urgent, or a fair task that ran well past t. Another cpu is told with
+ * a reschedule IPI.
+ */
+static void check_preempt_curr(struct rq *rq, struct task_struct *t)
+{
+	struct task_struct *curr = rq->curr;
+
+	if (curr == rq->idle || t->prio < curr->prio) {
+		resched_cpu(rq->cpu);
+	} else if (t->sched_class == &fair_sched_class &&
+		   curr->sched_class == &fair_sched_class &&
+		   check_preempt_wakeup_fair(rq, t)) {
+		resched_cpu(rq->cpu);
+	}
+}
+
+static void put_prev_task(struct rq *rq, struct task_struct *prev)
+{
+	if (prev == rq->idle) {
+		return;
+	}
+
+	prev->sched_class->put_prev_task(rq, prev);
+}
+
+/* Ask each class in turn, the pick never touches another cpu. */
+static struct task_struct *pick_next_task(struct rq *rq)
+{
+	const struct sched_class *class;
+	struct task_struct *t;
+
+	/* Only fair tasks are runnable, the common case. */
+	if (rq->nr_running == rq->cfs.nr_running) {
+		return pick_next_task_fair(rq);
+	}
+
+	for (class = sched_class_highest; class != NULL; class = class->next) {
+		t = class->pick_next_task(rq);
+		if (t != NULL) {
+			return t;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * prev's context is saved now, it may run on another cpu. If its affinity
+ * no longer allows this cpu, push it to an allowed one.
+ */
+static void finish_task_switch(struct task_struct *prev)
+{
+	struct rq *rq = this_rq();
+	int migrate = false;
+
+	if (prev != rq->curr) {
+		prev->on_cpu = false;
+		/* Taken off the queue by schedule(), see there. */
+		if (prev->state == RUNNING && !prev->on_rq &&
+		    !cpumask_test_cpu(rq->cpu, prev->cpus_allowed)) {
+			set_task_cpu(prev, select_task_rq(prev->cpus_allowed));
+			migrate = true;
+		}
+	}
+	spin_unlock(&rq->lock);
+
+	if (migrate) {
+		unsigned long flags;
+
+		rq = task_rq_lock(prev, &flags);
+		if (prev->state == RUNNING) {
+			enqueue_task(rq, prev);
+		}
+		task_rq_unlock(rq, flags);
+	}
+}
+
+/* First thing a newly created task runs, prev is left in x0 by cpu_switch_to. */
+void schedule_tail(struct task_struct *prev)
+{
+	finish_task_switch(prev);
+	enable_irq();
+}
+
+/*
+ * TTBR0_EL1 of each cpu, 0 when no user page table is loaded. A kernel thread
+ * runs on whatever table was loaded last, it doesn't touch user addresses.
+ */
+static DEFINE_PER_CPU(u64, loaded_ttbr0);
+static DEFINE_PER_CPU(unsigned int, ttbr0_writes);
+static DEFINE_PER_CPU(unsigned int, ttbr0_same_mm);	/* Write skipped. */
+static DEFINE_PER_CPU(unsigned int, ttbr0_lazy);	/* Kernel thread. */
+
+#define TTBR0_BADDR_MASK ((1UL << 48) - 1)
+
+/* Loads the page table of next, irqs are disabled. */
+static void switch_mm(struct task_struct *next, int cpu)
+{
+	u64 ttbr0;
+
+	if (next->pg_dir == NULL) {
+		per_cpu(ttbr0_lazy, cpu)++;
+		return;
+	}
+
+	/*
+	 * Still loaded with the same ASID: even if a rollover happened since,
+	 * that ASID stayed reserved for this cpu.
+	 */
+	ttbr0 = (ASID(next->mm) << 48) | (u64)__pa(next->pg_dir);
+	if (ttbr0 == per_cpu(loaded_ttbr0, cpu)) {
+		per_cpu(ttbr0_same_mm, cpu)++;
+		return;
+	}
+
+	check_and_switch_context(next->mm, cpu);
+	write_ttbr0_el1((u64)__pa(next->pg_dir), ASID(next->mm));
+	per_cpu(loaded_ttbr0, cpu) = (ASID(next->mm) << 48) |
+		(u64)__pa(next->pg_dir);
+	per_cpu(ttbr0_writes, cpu)++;
+}
+
+/* Loads the page table of t, the current task, e.g. once it's set up. */
+void activate_mm(struct task_struct *t)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	per_cpu(loaded_ttbr0, get_cpu_core_id()) = 0;
+	switch_mm(t, get_cpu_core_id());
+	local_irq_restore(flags);
+}
+
+static void drop_ttbr0(void *pg_dir)
+{
+	int cpu = get_cpu_core_id();
+
+	if ((per_cpu(loaded_ttbr0, cpu) & TTBR0_BADDR_MASK) ==
+	    (u64)__pa(pg_dir)) {
+		write_sys_reg(TTBR0_EL1, 0);
+		per_cpu(loaded_ttbr0, cpu) = 0;
+	}
+}
+
+/*
+ * pg_dir is about to be freed, no cpu may keep it in TTBR0_EL1, not even
+ * lazily for a kernel thread. Only the last exiting task of the mm uses it,
+ * no cpu can load it again meanwhile.
+ */
+static void unload_page_table(uint64_t *pg_dir)
+{
+	unsigned long flags;
+	int remote = false;
+	int cpu;
+
+	local_irq_save(flags);
+	drop_ttbr0(pg_dir);
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		if ((per_cpu(loaded_ttbr0, cpu) & TTBR0_BADDR_MASK) ==
+		    (u64)__pa(pg_dir)) {
+			remote = true;
+		}
+	}
+	local_irq_restore(flags);
+
+	if (remote) {
+		smp_call_function(drop_ttbr0, pg_dir, true);
+	}
+}
+
+/*
+ * A task that is not RUNNING leaves the run queue here, not when its state is
+ * set: a wakeup in between only has to set it RUNNING again. A preempted task
+ * stays queued whatever its state, it hasn't reached its own schedule() yet.
+ */
+static void __schedule(int preempt)
 {
 #ifdef DEBUG_SCHED
 	unsigned long sp;
 #endif
-
+	unsigned long flags;
+	struct rq *rq;
 	struct task_struct *prev;
 	struct task_struct *next;
 #ifdef DEBUG_SCHED
 	printk("In schedule\n");
 #endif
-	prev = get_current_proc();
-	next = get_next_proc();
+	if (preempt_count() != 0) {
+		printk("%s: scheduling while atomic, %s(pid=%d), preempt_count=%x\n",
+		       __FUNCTION__, get_current_proc()->comm,
+		       get_current_proc()->pid, preempt_count());
+	}
+
+	local_irq_save(flags);
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	per_cpu(__need_resched, rq->cpu) = false;
+
+	prev = rq->curr;
+	if (!preempt && prev != rq->idle && prev->state != RUNNING) {
+		dequeue_task(rq, prev);
+	}
+	put_prev_task(rq, prev);
+	/* Don't pick prev again if it may no longer run here. */
+	if (prev->on_rq && !cpumask_test_cpu(rq->cpu, prev->cpus_allowed)) {
+		dequeue_task(rq, prev);
+	}
+	next = pick_next_task(rq);
 
 	if (next == NULL) {
-		next = &swapper_task_struct[get_cpu_core_id()];
+		idle_balance(rq);
+		next = pick_next_task(rq);
+	}
+	if (next == NULL) {
+		next = rq->idle;
 	}
 #ifdef DEBUG_SCHED
 	asm volatile (
@@ -133,14 +719,249 @@ void schedule(void)
 		printk("next->pg_dir=%p\n", next->pg_dir);
 		printk("__pa(next->pg_dir)=%p\n", __pa(next->pg_dir));
 #endif
-		if (next->pg_dir != NULL) {
-			write_ttbr0_el1((u64)__pa(next->pg_dir), next->pid);
+		if (prev == rq->idle) {
+			rq->idle_cycles += get_cycles() - rq->idle_stamp;
+		} else if (next == rq->idle) {
+			rq->idle_stamp = get_cycles();
 		}
+		vtime_account();
+		rq->nr_switches++;
+		rq->curr = next;
+		next->on_cpu = true;
+		switch_mm(next, rq->cpu);
 		switch_to(prev, next, prev);
 #ifdef DEBUG_SCHED
 		printk("Last %s(pid=%d)\n", prev->comm,  prev->pid);
 #endif
 	}
+
+	finish_task_switch(prev);
+	local_irq_restore(flags);
+}
+
+void schedule(void)
+{
+	__schedule(false);
+}
+
+/* Called by preempt_enable(), irqs are enabled. */
+void preempt_schedule(void)
+{
+	if (preempt_count() != 0 || irqs_disabled()) {
+		return;
+	}
+
+	do {
+		__schedule(true);
+	} while (need_resched());
+}
+
+/*
+ * Called on return from an irq that interrupted EL1, irqs are disabled. A
+ * critical section that was interrupted reschedules at its end instead.
+ */
+void preempt_schedule_irq(void)
+{
+	if (preempt_count() != 0) {
+		return;
+	}
+
+	do {
+		enable_irq();
+		__schedule(true);
+		disable_irq();
+	} while (need_resched());
+}
+
+/*
+ * An idle cpu with its tick stopped would not steal from this busy one, wake
+ * one up so that it runs idle_balance(). The unlocked read may miss a cpu,
+ * it's retried on the next balance interval.
+ */
+static void kick_idle_cpu(struct rq *this_rq)
+{
+	struct rq *rq;
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		rq = cpu_rq(i);
+		if (rq != this_rq && rq->curr == rq->idle &&
+		    rq->nr_running == 0 && cpu_online(i)) {
+			per_cpu(__need_resched, i) = true;
+			smp_send_reschedule(i);
+			return;
+		}
+	}
+}
+
+/*
+ * Flags the running task for preemption when needed. The idle task always
+ * reschedules, so that an idle cpu tries to steal work on every tick.
+ */
+void scheduler_tick(void)
+{
+	unsigned long flags;
+	struct rq *rq;
+	int resched;
+
+	local_irq_save(flags);
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	if (rq->curr == rq->idle) {
+		resched = true;
+	} else {
+		resched = rq->curr->sched_class->task_tick(rq);
+	}
+	/* A more urgent real-time task waits, or curr may no longer run here. */
+	if (rt_rq_highest_prio(&rq->rt) < rq->curr->prio ||
+	    !cpumask_test_cpu(rq->cpu, rq->curr->cpus_allowed)) {
+		resched = true;
+	}
+	if (get_tick() >= rq->next_balance) {
+		rq->next_balance = get_tick() + SCHED_BALANCE_INTERVAL;
+		raise_softirq_irqoff(SOFTIRQ_SCHED);
+		if (rq->nr_running > 1) {
+			kick_idle_cpu(rq);
+		}
+	}
+	if (resched) {
+		set_need_resched();
+	}
+	spin_unlock(&rq->lock);
+	local_irq_restore(flags);
+}
+
+/*
+ * Called for a new task before it's made runnable, it's placed on the least
+ * loaded of its allowed cpus.
+ */
+void sched_fork(struct task_struct *t)
+{
+	unsigned long flags;
+	struct rq *rq;
+
+	if (rt_policy(t->policy)) {
+		t->prio = MAX_RT_PRIO - 1 - t->rt_priority;
+		t->sched_class = &rt_sched_class;
+	} else {
+		t->prio = NORMAL_PRIO;
+		t->sched_class = &fair_sched_class;
+	}
+	INIT_LIST_HEAD(&t->rt.run_list);
+	t->rt.time_slice = SCHED_RR_TIMESLICE;
+	/* It first runs schedule_tail(), that releases the rq lock. */
+	t->preempt_count = PREEMPT_OFFSET;
+
+	t->cpu = select_task_rq(t->cpus_allowed);
+	rq = task_rq_lock(t, &flags);
+	task_fork_fair(rq, t);
+	task_rq_unlock(rq, flags);
+}
+
+/*
+ * Whether t, looked up by pid without a lock, still is the live task of pid.
+ * A task_struct is freed and reused for another pid, not returned to the
+ * page allocator, see task_struct_cachep. Under the rq lock of t, which
+ * is held to make it a ZOMBIE, so t can't go away meanwhile.
+ */
+static int task_still_pid(const struct task_struct *t, int pid)
+{
+	return (t->in_use && t->pid == pid && t->state != STOPPED &&
+		t->state != ZOMBIE);
+}
+
+/*
+ * Change the policy and the static priority of t. A queued task is requeued
+ * in its new class; the running one keeps running, the tick preempts it if a
+ * more urgent task waits.
+ */
+static int __sched_setscheduler(struct task_struct *t, int pid, int policy,
+				const struct sched_param *param)
+{
+	unsigned long flags;
+	struct rq *rq;
+	int running;
+	int on_rq;
+
+	if (t == NULL || param == NULL) {
+		printk("%s: task_struct or param is null\n", __FUNCTION__);
+		return -1;
+	}
+	if (t->sched_class == NULL) {
+		/* The idle task. */
+		return -1;
+	}
+	if (rt_policy(policy)) {
+		if (param->sched_priority < 1 ||
+		    param->sched_priority > MAX_USER_RT_PRIO - 1) {
+			return -1;
+		}
+	} else if (policy != SCHED_NORMAL || param->sched_priority != 0) {
+		return -1;
+	}
+
+	rq = task_rq_lock(t, &flags);
+	if (pid != 0 && !task_still_pid(t, pid)) {
+		task_rq_unlock(rq, flags);
+		return -1;
+	}
+	running = (rq->curr == t);
+	on_rq = t->on_rq;
+	if (running) {
+		put_prev_task(rq, t);
+	}
+	if (on_rq) {
+		dequeue_task(rq, t);
+	}
+
+	t->policy = policy;
+	if (rt_policy(policy)) {
+		t->rt_priority = param->sched_priority;
+		t->prio = MAX_RT_PRIO - 1 - t->rt_priority;
+		t->sched_class = &rt_sched_class;
+		t->rt.time_slice = SCHED_RR_TIMESLICE;
+	} else {
+		t->rt_priority = 0;
+		t->prio = NORMAL_PRIO;
+		t->sched_class = &fair_sched_class;
+	}
+
+	if (on_rq) {
+		enqueue_task(rq, t);
+	}
+	if (running) {
+		t->sched_class->set_curr_task(rq, t);
+		resched_cpu(rq->cpu);
+	} else if (on_rq) {
+		check_preempt_curr(rq, t);
+	}
+	task_rq_unlock(rq, flags);
+
+	return 0;
+}
+
+int sched_setscheduler(struct task_struct *t, int policy,
+		       const struct sched_param *param)
+{
+	return __sched_setscheduler(t, 0, policy, param);
+}
+
+/* Of the task of pid, for the system call; pid 0 is the calling task. */
+int do_sched_setscheduler(int pid, int policy,
+			  const struct sched_param *param)
+{
+	struct task_struct *t;
+
+	if (pid == 0) {
+		return sched_setscheduler(get_current_proc(), policy, param);
+	}
+
+	t = pid_to_task(pid);
+	if (t == NULL) {
+		return -1;
+	}
+
+	return __sched_setscheduler(t, pid, policy, param);
 }
 
 static void process_timeout(unsigned long __data)
@@ -183,77 +1004,299 @@ void msleep(unsigned int msecs)
 	}
 }
 
-void free_task_slot(struct task_struct *t)
+/* tasks_lock is held. */
+static struct task_struct *alloc_task_struct(void)
+{
+	return kmem_cache_alloc(task_struct_cachep);
+}
+
+/* tasks_lock is held. */
+static void free_task_struct(struct task_struct *t)
+{
+	memset(t, 0, sizeof (*t));
+	kmem_cache_free(task_struct_cachep, t);
+}
+
+/* Next free pid after the last one given, so that pids are not reused soon. */
+static int alloc_pid(void)
+{
+	int pid;
+
+	pid = find_next_zero_bit(pid_map, PID_MAX, last_pid + 1);
+	if (pid >= PID_MAX) {
+		pid = find_next_zero_bit(pid_map, PID_MAX, 1);
+		if (pid >= PID_MAX) {
+			return -1;
+		}
+	}
+
+	__set_bit(pid, pid_map);
+	last_pid = pid;
+
+	return pid;
+}
+
+/* Unlinks t and releases its pid, tasks_lock is held. */
+static void unhash_task(struct task_struct *t)
+{
+	list_del(&t->sibling);
+	list_del(&t->tasks);
+	list_del(&t->pid_chain);
+	__clear_bit(t->pid, pid_map);
+	nr_tasks--;
+}
+
+/* Frees a task that was unhashed, without tasks_lock. */
+static void release_task(struct task_struct *t)
+{
+	unsigned long flags;
+
+	/* The stack was last used by the dead task, likely on another cpu. */
+	if (KERNEL_STACK_ORDER == 0) {
+		free_cold_page(t->stack);
+	} else {
+		free_pages(t->stack, KERNEL_STACK_ORDER);
+	}
+
+	fpsimd_release_task(t);
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	free_task_struct(t);
+	spin_unlock_irqrestore(&tasks_lock, flags);
+}
+
+void free_task_slot(struct task_struct *t)
+{
+	unsigned long flags;
+
+	if (t == NULL) {
+		printk("%s: task_struct is null\n", __FUNCTION__);
+		return;
+	}
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	unhash_task(t);
+	spin_unlock_irqrestore(&tasks_lock, flags);
+
+	release_task(t);
+}
+
+/*
+ * Frees the exited tasks that have been switched out for good, run by a
+ * worker. Checks again a tick later while some are still switching out.
+ */
+static void reap_dead_tasks(struct work_struct *work)
+{
+	struct task_struct *t, *n;
+	LIST_HEAD(reaped);
+	unsigned long flags;
+	int again;
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	list_for_each_entry_safe(t, n, &dead_tasks, tasks) {
+		if (!t->on_rq && !t->on_cpu) {
+			unhash_task(t);
+			list_add(&t->tasks, &reaped);
+		}
+	}
+	again = !list_empty(&dead_tasks);
+	spin_unlock_irqrestore(&tasks_lock, flags);
+
+	if (again) {
+		schedule_delayed_work(&reap_work, 1);
+	}
+
+	list_for_each_entry_safe(t, n, &reaped, tasks) {
+		printk("freeing task, pid=%d\n", t->pid);
+		list_del(&t->tasks);
+		release_task(t);
+	}
+}
+
+/*
+ * Allocates a task with a new pid and a kernel stack, returns NULL when pids
+ * or memory run out.
+ */
+struct task_struct *get_task_slot(void)
+{
+	struct task_struct *t;
+	void *stack;
+	unsigned long flags;
+	int pid;
+
+	stack = get_free_pages(KERNEL_STACK_ORDER);
+	if (stack == NULL) {
+		printk("%s: no memory for the kernel stack\n", __FUNCTION__);
+		return NULL;
+	}
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	pid = alloc_pid();
+	if (pid < 0) {
+		spin_unlock_irqrestore(&tasks_lock, flags);
+		free_pages(stack, KERNEL_STACK_ORDER);
+		printk("%s: out of pids\n", __FUNCTION__);
+		return NULL;
+	}
+	t = alloc_task_struct();
+	if (t == NULL) {
+		__clear_bit(pid, pid_map);
+		spin_unlock_irqrestore(&tasks_lock, flags);
+		free_pages(stack, KERNEL_STACK_ORDER);
+		printk("%s: no memory for the task_struct\n", __FUNCTION__);
+		return NULL;
+	}
+
+	t->in_use = true;
+	t->pid = pid;
+	t->stack = stack;
+	((struct thread_info *)(t->stack))->task = t;
+	t->cpu = get_cpu_core_id();
+	t->cpus_allowed = CPU_MASK_ALL;
+	fpsimd_flush_task_state(t);
+	INIT_LIST_HEAD(&t->children);
+	INIT_LIST_HEAD(&t->sibling);
+	init_waitqueue_head(&t->wait_chldexit);
+	list_add_tail(&t->tasks, &task_list);
+	list_add(&t->pid_chain, &pid_hash[pid_hashfn(pid)]);
+	nr_tasks++;
+	spin_unlock_irqrestore(&tasks_lock, flags);
+
+	return t;
+}
+
+struct task_struct *pid_to_task(int pid)
+{
+	struct task_struct *t;
+	unsigned long flags;
+
+	if (!(pid > 0 && pid < PID_MAX)) {
+		printk("%s: pid out of bound, pid=%d\n", __FUNCTION__, pid);
+		return NULL;
+	}
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	list_for_each_entry(t, &pid_hash[pid_hashfn(pid)], pid_chain) {
+		if (t->pid == pid) {
+			spin_unlock_irqrestore(&tasks_lock, flags);
+			return t;
+		}
+	}
+	spin_unlock_irqrestore(&tasks_lock, flags);
+
+	return NULL;
+}
+
+void set_task_state(struct task_struct *t, enum process_state state)
+{
+	unsigned long flags;
+	struct rq *rq;
+
+	if (t == NULL) {
+		printk("%s: task_struct is null\n", __FUNCTION__);
+		return;
+	}
+	if (state < 0 || state >= NUM_PROC_STATES) {
+		printk("%s: task state is invalid, state=%d\n", __FUNCTION__, state);
+		return;
+	}
+
+	rq = task_rq_lock(t, &flags);
+	t->state = state;
+	if (state == RUNNING) {
+		if (!t->on_rq) {
+			enqueue_task(rq, t);
+			check_preempt_curr(rq, t);
+		}
+	} else if (!t->on_cpu) {
+		/* The running task is dequeued by its schedule(). */
+		dequeue_task(rq, t);
+	}
+	task_rq_unlock(rq, flags);
+}
+
+/*
+ * Restrict t to the cpus of new_mask. A waiting or sleeping task is moved
+ * right away; a running one leaves its cpu at its next switch, the tick
+ * forces one.
+ */
+static int __set_cpus_allowed(struct task_struct *t, int pid,
+			      cpumask_t new_mask)
 {
 	unsigned long flags;
+	struct rq *rq;
+	struct rq *dst;
 
 	if (t == NULL) {
 		printk("%s: task_struct is null\n", __FUNCTION__);
-		return;
+		return -1;
 	}
 
-	flags = spin_lock_irqsave(&tasks_lock);
-	t->in_use = false;
-	memset(t, 0, sizeof (*t));
-	spin_unlock_irqrestore(&tasks_lock, flags);
-}
-
-struct task_struct *get_task_slot(void)
-{
-	int i;
-	unsigned long flags;
+	new_mask &= CPU_MASK_ALL;
+	if (new_mask == 0) {
+		return -1;
+	}
 
-	flags = spin_lock_irqsave(&tasks_lock);
-	for (i = 0; i < MAX_NUM_PROCESSES; i++) {
-		if (tasks[i].in_use == false) {
-			tasks[i].in_use = true;
-			tasks[i].pid = i + 1;
-			tasks[i].stack = &proc_kernel_stacks[i];
-			((struct thread_info *)(tasks[i].stack))->task =
-				&tasks[i];
+	rq = task_rq_lock(t, &flags);
+	if (pid != 0 && !task_still_pid(t, pid)) {
+		task_rq_unlock(rq, flags);
+		return -1;
+	}
+	t->cpus_allowed = new_mask;
+	if (cpumask_test_cpu(t->cpu, new_mask)) {
+		task_rq_unlock(rq, flags);
+		return 0;
+	}
 
-			spin_unlock_irqrestore(&tasks_lock, flags);
-			return &tasks[i];
-		} else if (tasks[i].state == STOPPED) {
-			printk("freeing task slot, pid=%d\n", tasks[i].pid);
-			invalidate_tlb_by_asid(tasks[i].pid);
-			tasks[i].in_use = false;
-			memset(&tasks[i], 0, sizeof (tasks[i]));
+	if (t->on_cpu) {
+		if (t == get_current_proc()) {
+			task_rq_unlock(rq, flags);
+			schedule();
+		} else {
+			resched_cpu(rq->cpu);
+			task_rq_unlock(rq, flags);
 		}
+		return 0;
 	}
 
-	spin_unlock_irqrestore(&tasks_lock, flags);
-	return NULL;
-}
-
-struct task_struct *pid_to_task(int pid)
-{
-	int index = pid - 1;
+	dst = cpu_rq(select_task_rq(new_mask));
+	if (!t->on_rq) {
+		set_task_cpu(t, dst->cpu);
+		task_rq_unlock(rq, flags);
+		return 0;
+	}
 
-	if (!(index >=0 && index < MAX_NUM_PROCESSES)) {
-		printk("%s: index out of bound, index=%d\n", __FUNCTION__, index);
-		return NULL;
+	double_lock_balance(rq, dst);
+	/* rq->lock may have been dropped, the task may be running by now. */
+	if (task_rq(t) == rq && t->on_rq && !t->on_cpu) {
+		move_task(rq, dst, t);
 	}
+	spin_unlock(&dst->lock);
+	task_rq_unlock(rq, flags);
+
+	return 0;
+}
 
-	return &tasks[index];
+int set_cpus_allowed(struct task_struct *t, cpumask_t new_mask)
+{
+	return __set_cpus_allowed(t, 0, new_mask);
 }
 
-void set_task_state(struct task_struct *t, enum process_state state)
+/* Of the task of pid, for the system call; pid 0 is the calling task. */
+int sched_setaffinity(int pid, cpumask_t new_mask)
 {
-	unsigned long flags;
+	struct task_struct *t;
 
-	if (t == NULL) {
-		printk("%s: task_struct is null\n", __FUNCTION__);
-		return;
+	if (pid == 0) {
+		return set_cpus_allowed(get_current_proc(), new_mask);
 	}
-	if (state < 0 || state >= NUM_PROC_STATES) {
-		printk("%s: task state is invalid, state=%d\n", __FUNCTION__, state);
-		return;
+
+	t = pid_to_task(pid);
+	if (t == NULL) {
+		return -1;
 	}
 
-	flags = spin_lock_irqsave(&tasks_lock);
-	t->state = state;
-	spin_unlock_irqrestore(&tasks_lock, flags);
+	return __set_cpus_allowed(t, pid, new_mask);
 }
 
 extern void call_thread_func(void);
@@ -283,7 +1326,7 @@ int kernel_thread(const char *name, const void *fn, const void *args)
 	t->thread.cpu_context.pc = (unsigned long)call_thread_func;
 	strncpy(t->comm, name, (TASK_COMM_LEN - 1));
 
-	mm = kzalloc(sizeof (*mm));
+	mm = mm_alloc();
 	if (mm == NULL) {
 		free_task_slot(t);
 		printk("%s: memory allocation failed for %s\n", __FUNCTION__, name);
@@ -297,7 +1340,8 @@ int kernel_thread(const char *name, const void *fn, const void *args)
 	*(--sp) = (unsigned long)args;
 	t->thread.cpu_context.sp = (unsigned long)sp;
 
-	t->state = RUNNING;
+	sched_fork(t);
+	set_task_state(t, RUNNING);
 
 	return 0;
 }
@@ -313,7 +1357,7 @@ static void free_page_tables_layer1(uint64_t *page_table)
 	}
 
 	for (i = 0; i < NUM_ENTRY_PER_PAGE; i++) {
-		if (page_table[i] != 0) {
+		if (page_table[i] != 0 && !is_block(page_table[i], layers[1])) {
 			void *entry = __va(get_phy_addr(page_table[i]));
 #ifdef DEBUG_EXIT_MM
 			printk("Freeing layer1 page table entry %p\n", entry);
@@ -337,7 +1381,7 @@ static void free_page_tables(uint64_t *pg_dir)
 	}
 
 	for (i = 0; i < NUM_ENTRY_PER_PAGE; i++) {
-		if (pg_dir[i] != 0) {
+		if (pg_dir[i] != 0 && !is_block(pg_dir[i], layers[0])) {
 			free_page_tables_layer1(__va(get_phy_addr(pg_dir[i])));
 		}
 	}
@@ -360,14 +1404,164 @@ static void free_pages_blocks(const struct vm_area_struct *vma)
 #ifdef DEBUG_EXIT_MM
 		printk("%s: user_virt_addr=%p, linear_addr=%p, order=%d\n", __FUNCTION__, pb->user_virt_addr, pb->linear_addr, pb->order);
 #endif
-		free_pages(pb->linear_addr, pb->order);
+		if (pb->order == 0) {
+			/* It may still be shared with a forked process. */
+			put_page(pb->linear_addr);
+		} else {
+			free_pages(pb->linear_addr, pb->order);
+		}
+	}
+}
+
+static void free_pages_block_list(struct vm_area_struct *vma)
+{
+	struct pages_block *pb;
+	struct pages_block *pb_dummy;
+
+	list_for_each_entry_safe(pb, pb_dummy, &vma->pages_block_list, list) {
+		del_pages_block(pb);
+	}
+}
+
+/* An mm with one user, or NULL. */
+struct mm_struct *mm_alloc(void)
+{
+	struct mm_struct *mm;
+
+	mm = kmem_cache_zalloc(mm_cachep);
+	if (mm == NULL) {
+		return NULL;
+	}
+	mm->mm_users = 1;
+	spin_lock_init(&mm->page_table_lock);
+
+	return mm;
+}
+
+/* One more task uses mm, e.g. a thread from clone(). */
+void mmget(struct mm_struct *mm)
+{
+	if (mm == NULL) {
+		printk("%s: mm is null\n", __FUNCTION__);
+		return;
+	}
+
+	__atomic_add_fetch(&mm->mm_users, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sets up a stack VMA for a thread of t's mm, returns its top or 0 once the
+ * slots ran out. The pages are allocated on faults, all go with
+ * free_thread_stack() when t exits.
+ */
+unsigned long alloc_thread_stack(struct task_struct *t)
+{
+	struct mm_struct *mm;
+	unsigned long start;
+	unsigned int slot;
+	int ret;
+
+	if (t == NULL || t->mm == NULL) {
+		printk("%s: task or its mm is null\n", __FUNCTION__);
+		return 0;
+	}
+
+	mm = t->mm;
+	spin_lock(&mm->page_table_lock);
+	slot = find_first_zero_bit(mm->thread_stacks, MAX_USER_THREAD_STACKS);
+	if (slot >= MAX_USER_THREAD_STACKS) {
+		spin_unlock(&mm->page_table_lock);
+		printk("%s: out of thread stacks\n", __FUNCTION__);
+		return 0;
+	}
+	start = USER_THREAD_STACKS_START + slot * USER_THREAD_STACK_SIZE;
+	ret = setup_vma(t, start, start + USER_THREAD_STACK_SIZE,
+			VM_READ | VM_WRITE, (unsigned long)(-1));
+	if (ret < 0) {
+		spin_unlock(&mm->page_table_lock);
+		printk("%s: setup_vma failed\n", __FUNCTION__);
+		return 0;
+	}
+	__set_bit(slot, mm->thread_stacks);
+	t->thread_stack = start;
+	spin_unlock(&mm->page_table_lock);
+
+	return start + USER_THREAD_STACK_SIZE;
+}
+
+/*
+ * The leaf entry of addr in the user page table, a page or a block, NULL if
+ * it has none. next, if not NULL, gets the next address which may have
+ * another one: the range of a block or of a missing table is skipped as a
+ * whole.
+ */
+static uint64_t *user_pte(uint64_t *pg_dir, unsigned long addr,
+			  unsigned long *next)
+{
+	uint64_t *pt = pg_dir;
+	uint64_t *entry = NULL;
+	int i;
+
+	for (i = 0; i < NUM_ELEMENTS(layers); i++) {
+		entry = &pt[get_pg_entry_index(addr, layers[i])];
+		if (*entry == 0 || is_block(*entry, layers[i])) {
+			if (next != NULL) {
+				*next = (addr | ((1UL << layers[i]) - 1)) + 1;
+			}
+			return (*entry == 0 ? NULL : entry);
+		}
+		pt = __va(get_phy_addr(*entry));
 	}
+
+	if (next != NULL) {
+		*next = PAGE_ADDR(addr) + PAGE_SIZE;
+	}
+	return entry;
+}
+
+/* The page entry of addr, a block mapping it is split first. */
+static uint64_t *user_page_pte(int asid, uint64_t *pg_dir, unsigned long addr,
+			       unsigned long *next)
+{
+	uint64_t *pt = pg_dir;
+	uint64_t *entry;
+	int i;
+
+	for (i = 0; i < NUM_ELEMENTS(layers) - 1; i++) {
+		entry = &pt[get_pg_entry_index(addr, layers[i])];
+		if (*entry == 0) {
+			break;
+		}
+		if (is_block(*entry, layers[i])) {
+			split_block(entry, layers[i], asid, (void *)addr,
+				    get_zeroed_pages);
+		}
+		pt = __va(get_phy_addr(*entry));
+	}
+
+	return user_pte(pg_dir, addr, next);
+}
+
+/* Whether addr has a page in the user page table. */
+int user_page_mapped(uint64_t *pg_dir, unsigned long addr)
+{
+	if (pg_dir == NULL) {
+		printk("%s: pg_dir is null\n", __FUNCTION__);
+		return false;
+	}
+
+	return (user_pte(pg_dir, addr, NULL) != NULL);
 }
 
+/*
+ * Drops the mm of tsk, the VMAs, pages and page tables go with the last
+ * user.
+ */
 void exit_mm(struct task_struct *tsk)
 {
 	struct vm_area_struct *vma;
 	struct vm_area_struct *vma_dummy;
+	struct mm_struct *mm;
 
 	if (tsk == NULL) {
 		printk("%s: task is null\n", __FUNCTION__);
@@ -378,6 +1572,17 @@ void exit_mm(struct task_struct *tsk)
 		return;
 	}
 
+	mm = tsk->mm;
+	if (tsk->thread_stack != 0) {
+		free_thread_stack(tsk);
+	}
+	if (__atomic_sub_fetch(&mm->mm_users, 1, __ATOMIC_ACQ_REL) != 0) {
+		/* The other users still run on the page table. */
+		tsk->mm = NULL;
+		tsk->pg_dir = NULL;
+		return;
+	}
+
 	for (vma = tsk->mm->mmap; vma != NULL; vma = vma_dummy) {
 		vma_dummy = vma->vm_next;
 		if (!(vma->vm_flags & VM_SHARED)) {
@@ -386,25 +1591,192 @@ void exit_mm(struct task_struct *tsk)
 #ifdef DEBUG_EXIT_MM
 		printk("Freeing vma %p\n", vma);
 #endif
-		kfree(vma);
+		free_pages_block_list(vma);
+		kmem_cache_free(vm_area_cachep, vma);
+	}
+
+	kmem_cache_free(mm_cachep, tsk->mm);
+	tsk->mm = NULL;
+	if (tsk->pg_dir != NULL) {
+		unload_page_table(tsk->pg_dir);
+		free_page_tables(tsk->pg_dir);
+		tsk->pg_dir = NULL;
+	}
+}
+
+/* child was just allocated, parent collects its exit code. */
+void link_child(struct task_struct *parent, struct task_struct *child)
+{
+	unsigned long flags;
+
+	if (parent == NULL || child == NULL) {
+		printk("%s: parent or child is null\n", __FUNCTION__);
+		return;
 	}
 
-	kfree(tsk->mm);
-	free_page_tables(tsk->pg_dir);
+	flags = spin_lock_irqsave(&tasks_lock);
+	child->parent = parent;
+	list_add_tail(&child->sibling, &parent->children);
+	spin_unlock_irqrestore(&tasks_lock, flags);
+}
+
+/*
+ * The children of an exiting task are reaped as soon as they exit, the
+ * zombies right away. Returns whether some went to dead_tasks. tasks_lock is
+ * held.
+ */
+static int forget_children(struct task_struct *t)
+{
+	struct task_struct *child, *n;
+	int reap = false;
+
+	list_for_each_entry_safe(child, n, &t->children, sibling) {
+		list_del_init(&child->sibling);
+		child->parent = NULL;
+		if (child->exit_state == EXIT_ZOMBIE) {
+			list_move_tail(&child->tasks, &dead_tasks);
+			reap = true;
+		}
+	}
+
+	return reap;
 }
 
+/*
+ * A task with a parent stays a zombie holding ret_val until the parent waits
+ * for it, others are reaped by the worker.
+ */
 void do_exit(unsigned long ret_val)
 {
 	struct task_struct *t;
+	unsigned long flags;
+	int reap;
 
 	t = get_current_proc();
 	printk("%s: %s exited, pid=%d, ret_val=%d\n", __FUNCTION__, t->comm, t->pid, ret_val);
 
 	exit_mm(t);
-	t->state = STOPPED;
+
+	flags = spin_lock_irqsave(&tasks_lock);
+	reap = forget_children(t);
+	t->exit_code = ret_val;
+	if (t->parent != NULL) {
+		t->exit_state = EXIT_ZOMBIE;
+		/* Under tasks_lock, the parent can't be reaped meanwhile. */
+		wake_up(&t->parent->wait_chldexit);
+	} else {
+		list_move_tail(&t->tasks, &dead_tasks);
+		reap = true;
+	}
+	spin_unlock_irqrestore(&tasks_lock, flags);
+	if (reap) {
+		schedule_delayed_work(&reap_work, 1);
+	}
+
+	set_task_state(t, ZOMBIE);
 	schedule();
 }
 
+static int wait_match(const struct task_struct *child, int pid)
+{
+	return (pid == -1 || child->pid == pid);
+}
+
+/*
+ * Waits for a child of current to exit, pid -1 is any child. Frees the child
+ * and returns its pid, 0 with WNOHANG if none has exited, -1 if there's no
+ * such child.
+ */
+int do_wait(int pid, int *status, int options, struct rusage *ru)
+{
+	struct task_struct *current = get_current_proc();
+	struct task_struct *child;
+	struct task_struct *zombie;
+	struct wait_queue_entry wq_entry;
+	unsigned long flags;
+	int found;
+	int ret;
+
+	init_waitqueue_entry(&wq_entry, current);
+	add_wait_queue(&current->wait_chldexit, &wq_entry);
+
+	while (true) {
+		set_task_state(current, SLEEPING);
+
+		found = false;
+		zombie = NULL;
+		flags = spin_lock_irqsave(&tasks_lock);
+		list_for_each_entry(child, &current->children, sibling) {
+			if (!wait_match(child, pid)) {
+				continue;
+			}
+			found = true;
+			if (child->exit_state == EXIT_ZOMBIE) {
+				zombie = child;
+				break;
+			}
+		}
+
+		/* A zombie may still be switching out, give it a tick. */
+		if (zombie != NULL && (zombie->on_rq || zombie->on_cpu)) {
+			spin_unlock_irqrestore(&tasks_lock, flags);
+			schedule_timeout(1);
+			continue;
+		}
+
+		if (zombie != NULL) {
+			unhash_task(zombie);
+			spin_unlock_irqrestore(&tasks_lock, flags);
+
+			ret = zombie->pid;
+			if (status != NULL) {
+				*status = __W_EXITCODE(zombie->exit_code);
+			}
+			if (ru != NULL) {
+				task_rusage(zombie, ru);
+			}
+			release_task(zombie);
+			break;
+		}
+		spin_unlock_irqrestore(&tasks_lock, flags);
+
+		if (!found) {
+			ret = -1;
+			break;
+		}
+		if (options & WNOHANG) {
+			ret = 0;
+			break;
+		}
+		schedule();
+	}
+
+	set_task_state(current, RUNNING);
+	remove_wait_queue(&current->wait_chldexit, &wq_entry);
+
+	return ret;
+}
+
+void dump_sched_stats(void)
+{
+	struct rq *rq;
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		rq = cpu_rq(i);
+		printk("rq@cpu%d: nr_running=%d, rt_nr_running=%d, nr_switches=%d, idle=%dms\n",
+		       i, rq->nr_running, rq->rt.rt_nr_running, rq->nr_switches,
+		       (u32)(rq->idle_cycles / USECS_TO_CYCLES(1000)));
+		printk("rq@cpu%d: lb_count=%d, lb_imbalanced=%d, lb_failed=%d, "
+		       "lb_idle_count=%d, lb_pulled=%d, lb_hot_skipped=%d\n",
+		       i, rq->lb_count, rq->lb_imbalanced, rq->lb_failed,
+		       rq->lb_idle_count, rq->lb_pulled, rq->lb_hot_skipped);
+		printk("cpu%d: ttbr0_writes=%d, ttbr0_same_mm=%d, ttbr0_lazy=%d\n",
+		       i, per_cpu(ttbr0_writes, i), per_cpu(ttbr0_same_mm, i),
+		       per_cpu(ttbr0_lazy, i));
+	}
+}
+
 static void dump_task_info(struct task_struct *t)
 {
 	struct thread_info *ti;
@@ -431,11 +1803,21 @@ static void dump_task_info(struct task_struct *t)
 		printk("@%p: mm=%p, mm->mmap=%p, mm->start_brk=%p, mm->brk=%p\n",
 		       t, t->mm, t->mm->mmap, t->mm->start_brk, t->mm->brk);
 	}
-	printk("@%p: stime=%d, utime=%d\n", t, t->stime, t->utime);
+	printk("@%p: stime=%dms, utime=%dms, irqtime=%dms, softirqtime=%dms\n",
+	       t, (u32)(t->stime / USECS_TO_CYCLES(1000)),
+	       (u32)(t->utime / USECS_TO_CYCLES(1000)),
+	       (u32)(t->irqtime / USECS_TO_CYCLES(1000)),
+	       (u32)(t->softirqtime / USECS_TO_CYCLES(1000)));
+	printk("@%p: cpu=%d, on_rq=%d, on_cpu=%d, cpus_allowed=%x, vruntime=%p, sum_exec_runtime=%p\n",
+	       t, t->cpu, t->on_rq, t->on_cpu, (u32)t->cpus_allowed,
+	       t->se.vruntime, t->se.sum_exec_runtime);
+	printk("@%p: policy=%d, rt_priority=%d, prio=%d\n",
+	       t, t->policy, t->rt_priority, t->prio);
 }
 
 void dump_tasks(void)
 {
+	struct task_struct *t;
 	int i;
 	unsigned long flags;
 
@@ -446,10 +1828,20 @@ void dump_tasks(void)
 		dump_task_info(&swapper_task_struct[i]);
 	}
 
-	for (i = 0; i < MAX_NUM_PROCESSES; i++) {
-		dump_task_info(&tasks[i]);
+	list_for_each_entry(t, &task_list, tasks) {
+		dump_task_info(t);
+	}
+	list_for_each_entry(t, &dead_tasks, tasks) {
+		dump_task_info(t);
 	}
+	printk("nr_tasks=%d, last_pid=%d\n", nr_tasks, last_pid);
 	spin_unlock_irqrestore(&tasks_lock, flags);
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("rq@cpu%d: nr_running=%d, curr=%s(pid=%d), min_vruntime=%p\n",
+		       i, cpu_rq(i)->nr_running, cpu_rq(i)->curr->comm,
+		       cpu_rq(i)->curr->pid, cpu_rq(i)->cfs.min_vruntime);
+	}
 }
 
 int setup_vma(struct task_struct *t, unsigned long vm_start,
@@ -463,7 +1855,7 @@ int setup_vma(struct task_struct *t, unsigned long vm_start,
 		return -1;
 	}
 
-	vma = kzalloc(sizeof (*vma));
+	vma = kmem_cache_zalloc(vm_area_cachep);
 	if (vma == NULL) {
 		return -1;
 	}
@@ -550,7 +1942,7 @@ int add_pages_block(struct vm_area_struct *vma, void *user_virt_addr,
 		return -1;
 	}
 
-	pb = (struct pages_block *)kmalloc(sizeof(*pb));
+	pb = kmem_cache_alloc(pages_block_cachep);
 	if (pb == NULL) {
 		return -1;
 	}
@@ -562,6 +1954,12 @@ int add_pages_block(struct vm_area_struct *vma, void *user_virt_addr,
 	return 0;
 }
 
+void del_pages_block(struct pages_block *pb)
+{
+	list_del(&pb->list);
+	kmem_cache_free(pages_block_cachep, pb);
+}
+
 void setup_user_page_mapping(uint64_t *pg_dir, void *virt_addr,
 				    void *phy_addr, size_t size,
 				    int rdonly)
@@ -611,6 +2009,12 @@ void setup_user_page_mappings(struct task_struct *t)
 	}
 }
 
+/* The page may still be mapped by a process forked from this one. */
+static void put_user_page(void *addr, unsigned int order)
+{
+	put_page(addr);
+}
+
 int unmap_user_page_mapping(int asid, uint64_t *pg_dir, void *virt_addr, size_t size)
 {
 	void *addr;
@@ -630,7 +2034,8 @@ int unmap_user_page_mapping(int asid, uint64_t *pg_dir, void *virt_addr, size_t
 
 	addr_end = virt_addr + size;
 	for (addr = virt_addr; addr < addr_end; addr += PAGE_SIZE) {
-		ret = unmap_one_user_page(asid, pg_dir, addr, free_pages);
+		ret = unmap_one_user_page(asid, pg_dir, addr, put_user_page,
+					  get_zeroed_pages);
 		if (ret < 0) {
 			printk("unmap_one_user_page failed, addr=%p\n", addr);
 			return -1;
@@ -642,3 +2047,173 @@ int unmap_user_page_mapping(int asid, uint64_t *pg_dir, void *virt_addr, size_t
 
 	return ret;
 }
+
+/*
+ * Shares the pages mapped in vma with dst_vma of a forked child instead of
+ * copying them, re. copy_page_range() of Linux: both map them read-only and
+ * take a copy on their first write, see do_wp_page(). The blocks of vma are
+ * split into pages. The TLB entries of the pages made read-only are left to
+ * the caller, asid is the one of vma. Returns -1 when out of memory.
+ */
+int copy_page_range(int asid, uint64_t *dst_pg_dir, uint64_t *src_pg_dir,
+		    struct vm_area_struct *dst_vma, struct vm_area_struct *vma)
+{
+	unsigned long addr;
+	unsigned long next;
+	uint64_t *pte;
+	void *page;
+
+	if (dst_pg_dir == NULL || src_pg_dir == NULL) {
+		printk("%s: pg_dir is null\n", __FUNCTION__);
+		return -1;
+	}
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr = next) {
+		pte = user_page_pte(asid, src_pg_dir, addr, &next);
+		if (pte == NULL) {
+			continue;
+		}
+		*pte |= PTE_RDONLY;
+		page = __va(get_phy_addr(*pte));
+		/* The pages of the kernel image have no users to count. */
+		if (page_in_pool(page)) {
+			if (add_pages_block(dst_vma, (void *)addr, page,
+					    0) < 0) {
+				return -1;
+			}
+			get_page(page);
+		}
+		setup_user_page_mapping(dst_pg_dir, (void *)addr, __pa(page),
+					PAGE_SIZE, true);
+	}
+
+	return 0;
+}
+
+static struct pages_block *find_pages_block(struct vm_area_struct *vma,
+					    unsigned long addr)
+{
+	struct pages_block *pb;
+
+	list_for_each_entry(pb, &vma->pages_block_list, list) {
+		if ((unsigned long)pb->user_virt_addr == addr) {
+			return pb;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * A write to a read-only page of the writable private vma, it's been shared
+ * since a fork or is the zero page. Its last user makes it writable again,
+ * the others take a copy, re. do_wp_page() of Linux. Called with the
+ * page_table_lock of mm. Returns -1 when out of memory.
+ */
+int do_wp_page(struct mm_struct *mm, uint64_t *pg_dir,
+	       struct vm_area_struct *vma, unsigned long addr)
+{
+	struct pages_block *pb;
+	uint64_t *pte;
+	uint64_t attrs;
+	void *old_page;
+	void *new_page;
+
+	addr = PAGE_ADDR(addr);
+	pte = user_page_pte(ASID(mm), pg_dir, addr, NULL);
+	if (pte == NULL) {
+		printk("%s: no page at addr=%p\n", __FUNCTION__, addr);
+		return -1;
+	}
+	/* Another thread of mm got here first. */
+	if (!(*pte & PTE_RDONLY)) {
+		return 0;
+	}
+
+	old_page = __va(get_phy_addr(*pte));
+	if (page_in_pool(old_page) && page_count(old_page) == 1) {
+		*pte &= ~PTE_RDONLY;
+		invalidate_tlb_by_va(ASID(mm), (void *)addr);
+		return 0;
+	}
+
+	if (old_page == empty_zero_page) {
+		new_page = get_zeroed_pages(0);
+	} else {
+		new_page = get_free_pages(0);
+		if (new_page != NULL) {
+			memcpy(new_page, old_page, PAGE_SIZE);
+		}
+	}
+	if (new_page == NULL) {
+		printk("%s: page allocation failed\n", __FUNCTION__);
+		return -1;
+	}
+
+	pb = find_pages_block(vma, addr);
+	if (pb != NULL) {
+		pb->linear_addr = new_page;
+	} else if (add_pages_block(vma, (void *)addr, new_page, 0) < 0) {
+		printk("%s: add_pages_block failed\n", __FUNCTION__);
+		free_pages(new_page, 0);
+		return -1;
+	}
+
+	/* Break before make, the output address changes. */
+	attrs = *pte & ~get_phy_addr(~0ULL) & ~PTE_RDONLY;
+	*pte = 0;
+	invalidate_tlb_by_va(ASID(mm), (void *)addr);
+	*pte = (uint64_t)__pa(new_page) | attrs;
+
+	if (pb != NULL) {
+		put_page(old_page);
+	}
+
+	return 0;
+}
+
+/*
+ * Unmaps the stack of the exiting thread t, frees its pages, its VMA and its
+ * slot. The other threads of the mm may still run.
+ */
+void free_thread_stack(struct task_struct *t)
+{
+	struct mm_struct *mm = t->mm;
+	struct vm_area_struct *vma;
+	unsigned long addr;
+	unsigned long next;
+	unsigned int slot;
+
+	spin_lock(&mm->page_table_lock);
+	vma = find_vma(mm, t->thread_stack);
+	if (vma == NULL) {
+		spin_unlock(&mm->page_table_lock);
+		printk("%s: no vma at %p\n", __FUNCTION__, t->thread_stack);
+		return;
+	}
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr = next) {
+		if (user_page_pte(ASID(mm), t->pg_dir, addr, &next) != NULL) {
+			unmap_one_user_page(ASID(mm), t->pg_dir, (void *)addr,
+					    put_user_page, get_zeroed_pages);
+		}
+	}
+	/* The pages went with their mappings. */
+	free_pages_block_list(vma);
+
+	if (vma->vm_prev != NULL) {
+		vma->vm_prev->vm_next = vma->vm_next;
+	} else {
+		mm->mmap = vma->vm_next;
+	}
+	if (vma->vm_next != NULL) {
+		vma->vm_next->vm_prev = vma->vm_prev;
+	}
+	kmem_cache_free(vm_area_cachep, vma);
+
+	slot = (t->thread_stack - USER_THREAD_STACKS_START) /
+		USER_THREAD_STACK_SIZE;
+	__clear_bit(slot, mm->thread_stacks);
+	t->thread_stack = 0;
+	spin_unlock(&mm->page_table_lock);
+}
@@ -0,0 +1,324 @@
+/*
+ * Completely fair scheduling class, re. kernel/sched_fair.c of Linux 2.6.23.
+ *
+ * Included by sched.c. Runnable tasks are kept in a red-black tree ordered by
+ * vruntime, the cycles they have run so far. The running task is not in the
+ * tree, it's cfs_rq->curr. All functions are called with rq->lock held.
+ */
+
+static u64 sysctl_sched_min_granularity =
+	USECS_TO_CYCLES(SCHED_MIN_GRANULARITY_US);
+static u64 sysctl_sched_latency = USECS_TO_CYCLES(SCHED_LATENCY_US);
+static u64 sysctl_sched_wakeup_granularity =
+	USECS_TO_CYCLES(SCHED_WAKEUP_GRANULARITY_US);
+static u64 sysctl_sched_migration_cost =
+	USECS_TO_CYCLES(SCHED_MIGRATION_COST_US);
+
+void sched_set_min_granularity(unsigned int usecs)
+{
+	sysctl_sched_min_granularity = USECS_TO_CYCLES(usecs);
+}
+
+static struct task_struct *task_of(struct sched_entity *se)
+{
+	return container_of(se, struct task_struct, se);
+}
+
+/* vruntime may wrap around, compare the difference. */
+static int entity_before(const struct sched_entity *a,
+			 const struct sched_entity *b)
+{
+	return ((int64_t)(a->vruntime - b->vruntime) < 0);
+}
+
+static u64 max_vruntime(u64 min_vruntime, u64 vruntime)
+{
+	if ((int64_t)(vruntime - min_vruntime) > 0) {
+		min_vruntime = vruntime;
+	}
+
+	return min_vruntime;
+}
+
+static u64 min_vruntime(u64 min_vruntime, u64 vruntime)
+{
+	if ((int64_t)(vruntime - min_vruntime) < 0) {
+		min_vruntime = vruntime;
+	}
+
+	return min_vruntime;
+}
+
+static void init_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	cfs_rq->tasks_timeline = RB_ROOT;
+	cfs_rq->rb_leftmost = NULL;
+	cfs_rq->curr = NULL;
+	cfs_rq->min_vruntime = 0;
+	cfs_rq->nr_running = 0;
+}
+
+static struct sched_entity *__pick_first_entity(struct cfs_rq *cfs_rq)
+{
+	if (cfs_rq->rb_leftmost == NULL) {
+		return NULL;
+	}
+
+	return rb_entry(cfs_rq->rb_leftmost, struct sched_entity, run_node);
+}
+
+/* min_vruntime only moves forward. */
+static void update_min_vruntime(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *first = __pick_first_entity(cfs_rq);
+	u64 vruntime = cfs_rq->min_vruntime;
+
+	if (cfs_rq->curr != NULL) {
+		vruntime = cfs_rq->curr->vruntime;
+	}
+
+	if (first != NULL) {
+		if (cfs_rq->curr == NULL) {
+			vruntime = first->vruntime;
+		} else {
+			vruntime = min_vruntime(vruntime, first->vruntime);
+		}
+	}
+
+	cfs_rq->min_vruntime = max_vruntime(cfs_rq->min_vruntime, vruntime);
+}
+
+static void __enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	struct rb_node **link = &cfs_rq->tasks_timeline.rb_node;
+	struct rb_node *parent = NULL;
+	struct sched_entity *entry;
+	int leftmost = true;
+
+	while (*link != NULL) {
+		parent = *link;
+		entry = rb_entry(parent, struct sched_entity, run_node);
+		if (entity_before(se, entry)) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	if (leftmost) {
+		cfs_rq->rb_leftmost = &se->run_node;
+	}
+
+	rb_link_node(&se->run_node, parent, link);
+	rb_insert_color(&se->run_node, &cfs_rq->tasks_timeline);
+}
+
+static void __dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	if (cfs_rq->rb_leftmost == &se->run_node) {
+		cfs_rq->rb_leftmost = rb_next(&se->run_node);
+	}
+
+	rb_erase(&se->run_node, &cfs_rq->tasks_timeline);
+}
+
+/* Charge the running task for the cycles since it was last accounted. */
+static void update_curr(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *curr = cfs_rq->curr;
+	u64 now = get_cycles();
+	u64 delta_exec;
+
+	if (curr == NULL) {
+		return;
+	}
+
+	delta_exec = now - curr->exec_start;
+	curr->exec_start = now;
+	curr->sum_exec_runtime += delta_exec;
+	curr->vruntime += delta_exec;
+
+	update_min_vruntime(cfs_rq);
+}
+
+/*
+ * A task that slept for long would come back with a tiny vruntime and hog the
+ * cpu, clamp it to at most half a latency period behind min_vruntime.
+ */
+static void place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	u64 vruntime = cfs_rq->min_vruntime - sysctl_sched_latency / 2;
+
+	se->vruntime = max_vruntime(se->vruntime, vruntime);
+}
+
+static void enqueue_task_fair(struct rq *rq, struct task_struct *t)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se = &t->se;
+
+	update_curr(cfs_rq);
+	place_entity(cfs_rq, se);
+	if (se != cfs_rq->curr) {
+		__enqueue_entity(cfs_rq, se);
+	}
+	cfs_rq->nr_running++;
+}
+
+static void dequeue_task_fair(struct rq *rq, struct task_struct *t)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se = &t->se;
+
+	update_curr(cfs_rq);
+	if (se != cfs_rq->curr) {
+		__dequeue_entity(cfs_rq, se);
+	}
+	cfs_rq->nr_running--;
+}
+
+/* Put the previously running task back into the tree if it's still runnable. */
+static void put_prev_task_fair(struct rq *rq, struct task_struct *prev)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+
+	if (cfs_rq->curr != &prev->se) {
+		return;
+	}
+
+	update_curr(cfs_rq);
+	if (prev->on_rq) {
+		__enqueue_entity(cfs_rq, &prev->se);
+	}
+	cfs_rq->curr = NULL;
+}
+
+static struct task_struct *pick_next_task_fair(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se;
+
+	se = __pick_first_entity(cfs_rq);
+	if (se == NULL) {
+		return NULL;
+	}
+
+	__dequeue_entity(cfs_rq, se);
+	se->exec_start = get_cycles();
+	se->prev_sum_exec_runtime = se->sum_exec_runtime;
+	cfs_rq->curr = se;
+
+	return task_of(se);
+}
+
+/* The running task t changed class or priority, make it cfs_rq->curr again. */
+static void set_curr_task_fair(struct rq *rq, struct task_struct *t)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se = &t->se;
+
+	if (t->on_rq) {
+		__dequeue_entity(cfs_rq, se);
+	}
+	se->exec_start = get_cycles();
+	se->prev_sum_exec_runtime = se->sum_exec_runtime;
+	cfs_rq->curr = se;
+}
+
+/*
+ * Called from the tick, returns whether the running task should be preempted:
+ * it has run for the minimum granularity and a task with less vruntime waits.
+ */
+static int task_tick_fair(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *curr = cfs_rq->curr;
+	struct sched_entity *first;
+
+	if (curr == NULL) {
+		return (cfs_rq->nr_running > 0);
+	}
+
+	update_curr(cfs_rq);
+	if (curr->sum_exec_runtime - curr->prev_sum_exec_runtime <
+	    sysctl_sched_min_granularity) {
+		return false;
+	}
+
+	first = __pick_first_entity(cfs_rq);
+
+	return (first != NULL && entity_before(first, curr));
+}
+
+/*
+ * t was woken on rq: it preempts the running fair task if that one is ahead
+ * in vruntime by more than the wakeup granularity, re. check_preempt_wakeup().
+ */
+static int check_preempt_wakeup_fair(struct rq *rq, struct task_struct *t)
+{
+	struct sched_entity *curr = &rq->curr->se;
+
+	update_curr(&rq->cfs);
+
+	return ((int64_t)(curr->vruntime - t->se.vruntime) >
+		(int64_t)sysctl_sched_wakeup_granularity);
+}
+
+/* New tasks start at min_vruntime plus a granularity, so forks don't starve others. */
+static void task_fork_fair(struct rq *rq, struct task_struct *t)
+{
+	struct sched_entity *se = &t->se;
+
+	update_curr(&rq->cfs);
+	se->vruntime = rq->cfs.min_vruntime + sysctl_sched_min_granularity;
+	se->exec_start = 0;
+	se->sum_exec_runtime = 0;
+	se->prev_sum_exec_runtime = 0;
+}
+
+/* A task that ran within the migration cost likely has its data in the cache. */
+static int task_hot(const struct task_struct *t, u64 now)
+{
+	if (t->se.exec_start == 0) {
+		return false;
+	}
+
+	return (now - t->se.exec_start < sysctl_sched_migration_cost);
+}
+
+/*
+ * A waiting task that may be moved to dst_cpu. Start from the largest
+ * vruntime, it's the last one to run here anyway.
+ */
+static struct task_struct *pick_migratable_task_fair(struct rq *rq, u64 now,
+						     int dst_cpu)
+{
+	struct rb_node *node;
+	struct task_struct *t;
+
+	for (node = rb_last(&rq->cfs.tasks_timeline); node != NULL;
+	     node = rb_prev(node)) {
+		t = task_of(rb_entry(node, struct sched_entity, run_node));
+		if (t->on_cpu || !cpumask_test_cpu(dst_cpu, t->cpus_allowed)) {
+			continue;
+		}
+		if (task_hot(t, now)) {
+			rq->lb_hot_skipped++;
+			continue;
+		}
+		return t;
+	}
+
+	return NULL;
+}
+
+static const struct sched_class fair_sched_class = {
+	.next = NULL,
+	.enqueue_task = enqueue_task_fair,
+	.dequeue_task = dequeue_task_fair,
+	.put_prev_task = put_prev_task_fair,
+	.pick_next_task = pick_next_task_fair,
+	.set_curr_task = set_curr_task_fair,
+	.task_tick = task_tick_fair,
+};
@@ -0,0 +1,147 @@
+/*
+ * Real-time scheduling class (SCHED_FIFO, SCHED_RR), re. kernel/sched_rt.c of
+ * Linux 2.6.23.
+ *
+ * Included by sched.c. Runnable tasks are kept in one list per priority, a
+ * bitmap of the non-empty lists gives the most urgent one in O(1). Unlike the
+ * fair class, the running task stays in its list. All functions are called
+ * with rq->lock held.
+ */
+
+static void init_rt_rq(struct rt_rq *rt_rq)
+{
+	struct rt_prio_array *array = &rt_rq->active;
+	int i;
+
+	for (i = 0; i < MAX_RT_PRIO; i++) {
+		INIT_LIST_HEAD(&array->queue[i]);
+	}
+	memset(array->bitmap, 0, sizeof (array->bitmap));
+	rt_rq->rt_nr_running = 0;
+}
+
+static int rt_policy(int policy)
+{
+	return (policy == SCHED_FIFO || policy == SCHED_RR);
+}
+
+static struct task_struct *rt_task_of(struct sched_rt_entity *rt_se)
+{
+	return container_of(rt_se, struct task_struct, rt);
+}
+
+/* Priority of the most urgent runnable task, MAX_RT_PRIO if there's none. */
+static int rt_rq_highest_prio(const struct rt_rq *rt_rq)
+{
+	return find_first_bit(rt_rq->active.bitmap, MAX_RT_PRIO);
+}
+
+static void enqueue_task_rt(struct rq *rq, struct task_struct *t)
+{
+	struct rt_prio_array *array = &rq->rt.active;
+
+	list_add_tail(&t->rt.run_list, &array->queue[t->prio]);
+	__set_bit(t->prio, array->bitmap);
+	rq->rt.rt_nr_running++;
+}
+
+static void dequeue_task_rt(struct rq *rq, struct task_struct *t)
+{
+	struct rt_prio_array *array = &rq->rt.active;
+
+	list_del_init(&t->rt.run_list);
+	if (list_empty(&array->queue[t->prio])) {
+		__clear_bit(t->prio, array->bitmap);
+	}
+	rq->rt.rt_nr_running--;
+}
+
+static void put_prev_task_rt(struct rq *rq, struct task_struct *prev)
+{
+}
+
+static void set_curr_task_rt(struct rq *rq, struct task_struct *t)
+{
+}
+
+static struct task_struct *pick_next_task_rt(struct rq *rq)
+{
+	struct rt_prio_array *array = &rq->rt.active;
+	int idx;
+
+	idx = rt_rq_highest_prio(&rq->rt);
+	if (idx >= MAX_RT_PRIO) {
+		return NULL;
+	}
+
+	return rt_task_of(list_first_entry(&array->queue[idx],
+					   struct sched_rt_entity, run_list));
+}
+
+/*
+ * A SCHED_RR task goes to the tail of its list when its slice is used up,
+ * SCHED_FIFO runs until it blocks or a more urgent task is runnable.
+ */
+static int task_tick_rt(struct rq *rq)
+{
+	struct task_struct *curr = rq->curr;
+	struct list_head *queue = &rq->rt.active.queue[curr->prio];
+
+	if (curr->policy != SCHED_RR) {
+		return false;
+	}
+
+	if (--curr->rt.time_slice > 0) {
+		return false;
+	}
+
+	curr->rt.time_slice = SCHED_RR_TIMESLICE;
+	if (queue->next != queue->prev) {
+		list_move_tail(&curr->rt.run_list, queue);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * A waiting task that may be moved to dst_cpu, from the least urgent
+ * priority up.
+ */
+static struct task_struct *pick_migratable_task_rt(struct rq *rq, int dst_cpu)
+{
+	struct rt_prio_array *array = &rq->rt.active;
+	struct sched_rt_entity *rt_se;
+	struct task_struct *t;
+	int idx;
+
+	if (rq->rt.rt_nr_running == 0) {
+		return NULL;
+	}
+
+	for (idx = MAX_RT_PRIO - 1; idx >= 0; idx--) {
+		if (!test_bit(idx, array->bitmap)) {
+			continue;
+		}
+		list_for_each_entry(rt_se, &array->queue[idx], run_list) {
+			t = rt_task_of(rt_se);
+			if (t->on_cpu ||
+			    !cpumask_test_cpu(dst_cpu, t->cpus_allowed)) {
+				continue;
+			}
+			return t;
+		}
+	}
+
+	return NULL;
+}
+
+static const struct sched_class rt_sched_class = {
+	.next = &fair_sched_class,
+	.enqueue_task = enqueue_task_rt,
+	.dequeue_task = dequeue_task_rt,
+	.put_prev_task = put_prev_task_rt,
+	.pick_next_task = pick_next_task_rt,
+	.set_curr_task = set_curr_task_rt,
+	.task_tick = task_tick_rt,
+};
@@ -0,0 +1,190 @@
+#include <arch.h>
+#include <hardware.h>
+#include <mmu.h>
+#include <printk.h>
+#include <percpu.h>
+#include <spinlock.h>
+#include <preempt.h>
+#include <sched.h>
+#include <hw_timer.h>
+#include <smp.h>
+
+#define GICD_ISENABLER0 0x100
+#define GICD_SGIR 0xF00
+
+static DEFINE_PER_CPU(int, online);
+static DEFINE_PER_CPU(unsigned int, ipi_sent);
+static DEFINE_PER_CPU(unsigned int, ipi_received);
+
+/*
+ * The cross call in flight, smp_call_function() runs one at a time. Each
+ * target flags when it has taken func and info, and when func returned.
+ */
+static struct spinlock call_lock;
+static struct {
+	void (*func)(void *info);
+	void *info;
+} call_data;
+static DEFINE_PER_CPU(volatile int, call_started);
+static DEFINE_PER_CPU(volatile int, call_finished);
+
+/* GICD_SGIR: target list in bits 16-23, interrupt id in bits 0-3. */
+static void gic_send_sgi(uint8_t cpu_target_mask, unsigned int sgi)
+{
+	/* The data the target reads must be visible before the interrupt. */
+	smp_mb();
+	*(volatile uint32_t *)__va(VIRT_GIC_DIST_BASE + GICD_SGIR) =
+		((uint32_t)cpu_target_mask << 16) | (sgi & 0xF);
+}
+
+/* Called by each cpu once its gic cpu interface takes interrupts. */
+void init_ipi(void)
+{
+	int cpu = get_cpu_core_id();
+
+	if (cpu == 0) {
+		spin_lock_init(&call_lock);
+	}
+
+	/* The SGI enables are banked per cpu. */
+	*(volatile uint32_t *)__va(VIRT_GIC_DIST_BASE + GICD_ISENABLER0) =
+		(1 << IRQ_IPI_RESCHEDULE) | (1 << IRQ_IPI_CALL_FUNC) |
+		(1 << IRQ_IPI_WORK);
+
+	smp_mb();
+	per_cpu(online, cpu) = true;
+}
+
+int cpu_online(int cpu)
+{
+	return per_cpu(online, cpu);
+}
+
+void smp_send_reschedule(int cpu)
+{
+	if (!cpu_online(cpu)) {
+		return;
+	}
+
+	per_cpu(ipi_sent, get_cpu_core_id())++;
+	gic_send_sgi(1 << cpu, IRQ_IPI_RESCHEDULE);
+}
+
+/*
+ * The sender sets need_resched first when the running task is to be
+ * preempted, the irq return path acts on it. The cpu may also have stopped
+ * its tick with one task, bring it back if a second one is queued.
+ */
+void handle_ipi_reschedule(void)
+{
+	int cpu = get_cpu_core_id();
+
+	per_cpu(ipi_received, cpu)++;
+	if (nr_running_cpu(cpu) > 1) {
+		tick_nohz_restart();
+	}
+}
+
+/*
+ * Interrupts this cpu once it enables irqs again, for work that can't be
+ * queued where it's found, e.g. with a run queue lock held.
+ */
+void smp_send_work_ipi(void)
+{
+	per_cpu(ipi_sent, get_cpu_core_id())++;
+	gic_send_sgi(1 << get_cpu_core_id(), IRQ_IPI_WORK);
+}
+
+void handle_ipi_work(void)
+{
+	per_cpu(ipi_received, get_cpu_core_id())++;
+	printk_ipi_work();
+}
+
+void handle_ipi_call_function(void)
+{
+	int cpu = get_cpu_core_id();
+	void (*func)(void *info);
+	void *info;
+
+	per_cpu(ipi_received, cpu)++;
+	func = call_data.func;
+	info = call_data.info;
+	smp_mb();
+	per_cpu(call_started, cpu) = true;
+
+	func(info);
+
+	smp_mb();
+	per_cpu(call_finished, cpu) = true;
+}
+
+/*
+ * Run func(info) on all the other online cpus, from their irq context. With
+ * wait, returns once all of them are done, otherwise once all of them have
+ * started. Must be called with irqs enabled: two cpus calling at the same
+ * time serve each other's interrupt while spinning on call_lock.
+ */
+int smp_call_function(void (*func)(void *info), void *info, int wait)
+{
+	int this_cpu;
+	uint8_t mask = 0;
+	int cpu;
+
+	if (func == NULL) {
+		printk("%s: func is null\n", __FUNCTION__);
+		return -1;
+	}
+	if (irqs_disabled()) {
+		printk("%s: called with irqs disabled\n", __FUNCTION__);
+		return -1;
+	}
+
+	spin_lock(&call_lock);
+	this_cpu = get_cpu_core_id();
+	call_data.func = func;
+	call_data.info = info;
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		if (cpu == this_cpu || !cpu_online(cpu)) {
+			continue;
+		}
+		per_cpu(call_started, cpu) = false;
+		per_cpu(call_finished, cpu) = false;
+		mask |= (1 << cpu);
+	}
+
+	if (mask != 0) {
+		per_cpu(ipi_sent, this_cpu)++;
+		gic_send_sgi(mask, IRQ_IPI_CALL_FUNC);
+	}
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		if ((mask & (1 << cpu)) == 0) {
+			continue;
+		}
+		if (wait) {
+			while (!per_cpu(call_finished, cpu)) {
+				;
+			}
+		} else {
+			while (!per_cpu(call_started, cpu)) {
+				;
+			}
+		}
+	}
+	smp_mb();
+	spin_unlock(&call_lock);
+
+	return 0;
+}
+
+void dump_ipi_stats(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("cpu%d: online=%d, ipi_sent=%d, ipi_received=%d\n",
+		       i, per_cpu(online, i), per_cpu(ipi_sent, i),
+		       per_cpu(ipi_received, i));
+	}
+}
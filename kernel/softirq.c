@@ -2,6 +2,8 @@
 #include <misc.h>
 #include <percpu.h>
 #include <printk.h>
+#include <preempt.h>
+#include <cputime.h>
 
 struct softirq_action {
 	void (*action)(void);
@@ -9,7 +11,6 @@ struct softirq_action {
 
 static struct softirq_action softirq_vec[MAX_NUM_SOFTIRQ];
 
-DEFINE_PER_CPU(int, nested_softirq_count);
 DEFINE_PER_CPU(int, __softirq_pending);
 
 void open_softirq(int nr, void (*action)(void))
@@ -55,6 +56,10 @@ static int is_softirq_pending(int softirq_pending, unsigned int nr)
 	return ((softirq_pending & (1 << nr)) != 0);
 }
 
+/*
+ * Runs the pending softirqs with SOFTIRQ_OFFSET in preempt_count, so that
+ * they are neither nested nor preempted.
+ */
 void do_softirq(void)
 {
 	int i;
@@ -62,11 +67,12 @@ void do_softirq(void)
 	int softirq_pending;
 
 	local_irq_save(flags);
-	if (per_cpu(nested_softirq_count, get_cpu_core_id()) != 0) {
+	if (in_interrupt()) {
 		local_irq_restore(flags);
 		return;
 	}
-	per_cpu(nested_softirq_count, get_cpu_core_id())++;
+	vtime_account();
+	preempt_count_add(SOFTIRQ_OFFSET);
 	softirq_pending = per_cpu(__softirq_pending, get_cpu_core_id());
 	per_cpu(__softirq_pending, get_cpu_core_id()) = 0;
 	local_irq_restore(flags);
@@ -77,7 +83,23 @@ void do_softirq(void)
 		}
 	}
 
-	local_irq_save(flags);
-	per_cpu(nested_softirq_count, get_cpu_core_id())--;
-	local_irq_restore(flags);
+	vtime_account();
+	preempt_count_sub(SOFTIRQ_OFFSET);
+}
+
+void irq_enter(void)
+{
+	vtime_account();
+	preempt_count_add(HARDIRQ_OFFSET);
+}
+
+/* The softirqs raised by the handler run on the way out of the irq. */
+void irq_exit(void)
+{
+	vtime_account();
+	preempt_count_sub(HARDIRQ_OFFSET);
+	if (!in_interrupt() &&
+	    per_cpu(__softirq_pending, get_cpu_core_id()) != 0) {
+		do_softirq();
+	}
 }
@@ -4,6 +4,7 @@
 #include <arch.h>
 #include <printk.h>
 #include <stddef.h>
+#include <preempt.h>
 
 void spin_lock_init(struct spinlock *lock)
 {
@@ -16,10 +17,10 @@ void spin_lock_init(struct spinlock *lock)
 }
 
 #ifdef DEBUG_SPINLOCK_NULLIFY
-void spin_lock(struct spinlock *lock)
+void arch_spin_lock(struct spinlock *lock)
 {
 }
-void spin_unlock(struct spinlock *lock)
+void arch_spin_unlock(struct spinlock *lock)
 {
 }
 #elif defined SPIN_LOCK_IN_C
@@ -51,7 +52,7 @@ static u64 stxr_func(u64 value, void *addr)
 	return ret;
 }
 
-void spin_lock(struct spinlock *lock)
+void arch_spin_lock(struct spinlock *lock)
 {
 	u64 state;
 	unsigned long flags;
@@ -78,7 +79,7 @@ void spin_lock(struct spinlock *lock)
 	}
 }
 
-void spin_unlock(struct spinlock *lock)
+void arch_spin_unlock(struct spinlock *lock)
 {
 	u64 state;
 	unsigned long flags;
@@ -98,6 +99,19 @@ void spin_unlock(struct spinlock *lock)
 }
 #endif
 
+/* A held spinlock disables preemption, the outermost unlock is a preemption point. */
+void spin_lock(struct spinlock *lock)
+{
+	preempt_disable();
+	arch_spin_lock(lock);
+}
+
+void spin_unlock(struct spinlock *lock)
+{
+	arch_spin_unlock(lock);
+	preempt_enable();
+}
+
 void print_spin_lock(struct spinlock *lock)
 {
 	if (lock == NULL) {
@@ -116,7 +130,8 @@ unsigned long spin_lock_irqsave(struct spinlock *lock)
 	assert(lock != NULL);
 
 	local_irq_save(flags);
-	spin_lock(lock);
+	preempt_disable();
+	arch_spin_lock(lock);
 
 	return flags;
 }
@@ -128,6 +143,7 @@ void spin_unlock_irqrestore(struct spinlock *lock, unsigned long flags)
 		return;
 	}
 
-	spin_unlock(lock);
+	arch_spin_unlock(lock);
 	local_irq_restore(flags);
+	preempt_enable();
 }
@@ -41,6 +41,8 @@ void add_timer(struct timer *p)
 	flags = spin_lock_irqsave(&timerlist_lock);
 	_add_timer(p);
 	spin_unlock_irqrestore(&timerlist_lock, flags);
+
+	tick_nohz_timer_added(p->expires);
 }
 
 void _del_timer(struct timer *p)
@@ -95,6 +97,30 @@ void mod_timer(struct timer *p, unsigned long expires)
 	flags = spin_lock_irqsave(&timerlist_lock);
 	_mod_timer(p, expires);
 	spin_unlock_irqrestore(&timerlist_lock, flags);
+
+	tick_nohz_timer_added(expires);
+}
+
+/*
+ * Lower *next to the earliest expiry of the pending timers, returns whether
+ * there is any pending timer.
+ */
+int next_timer_interrupt(uint64_t *next)
+{
+	struct timer *cur;
+	unsigned long flags;
+	int found = false;
+
+	flags = spin_lock_irqsave(&timerlist_lock);
+	for (cur = head; cur != NULL; cur = cur->next) {
+		if ((long)(cur->expires - *next) < 0) {
+			*next = cur->expires;
+		}
+		found = true;
+	}
+	spin_unlock_irqrestore(&timerlist_lock, flags);
+
+	return found;
 }
 
 void run_timer_softirq(void)
@@ -111,7 +137,8 @@ void run_timer_softirq(void)
 	flags = spin_lock_irqsave(&timerlist_lock);
 	cur = head;
 	while (cur != NULL) {
-		if (cur->expires == tick) {
+		/* Ticks may have been skipped while the cpus slept. */
+		if ((long)(tick - cur->expires) >= 0) {
 			_del_timer(cur);
 			spin_unlock_irqrestore(&timerlist_lock, flags);
 			cur->function(cur->data);
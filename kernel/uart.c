@@ -7,13 +7,19 @@
 #include <sched.h>
 #include <percpu.h>
 #include <hw_timer.h>
+#include <smp.h>
+#include <cputime.h>
+#include <fpsimd.h>
+#include <mmu_context.h>
 #include <wait.h>
+#include <workqueue.h>
+#include <memory.h>
+#include <slab.h>
 
 extern struct concurrent_cbuf kernel_log;
 
 struct wait_queue_head uib_wq_head;
 
-#define UART_IN_BUF_LEN 256
 uint8_t uart_in_buf[UART_IN_BUF_LEN];
 int uib_index;
 struct spinlock uib_lock;
@@ -55,11 +61,18 @@ void init_uart(void)
 	spin_lock_init(&uib_lock);
 }
 
+/*
+ * Writes the first logged char, the tx irq drains the rest. Runs on the cpu
+ * the uart irq goes to, irqs are disabled so that the irq doesn't clear
+ * uart_busy in between.
+ */
 void start_uart_tx(void)
 {
+	unsigned long flags;
 	int ret;
 	char c;
 
+	local_irq_save(flags);
 	if (!uart_busy) {
 		ret = read_concurrent_cbuf(&kernel_log, &c, 1);
 		if (ret == 1) {
@@ -67,6 +80,7 @@ void start_uart_tx(void)
 			uart_busy = true;
 		}
 	}
+	local_irq_restore(flags);
 }
 
 static void handle_magic_keys(char c)
@@ -87,6 +101,36 @@ static void handle_magic_keys(char c)
 		if (c == 'p') {
 			dump_tasks();
 		}
+		if (c == 's') {
+			dump_sched_stats();
+		}
+		if (c == 't') {
+			dump_tick_stats();
+		}
+		if (c == 'i') {
+			dump_ipi_stats();
+		}
+		if (c == 'c') {
+			dump_cputime_stats();
+		}
+		if (c == 'f') {
+			dump_fpsimd_stats();
+		}
+		if (c == 'a') {
+			dump_asid_stats();
+		}
+		if (c == 'w') {
+			dump_workqueue_stats();
+		}
+		if (c == 'b') {
+			dump_buddy_stats();
+		}
+		if (c == 'k') {
+			dump_slab_stats();
+		}
+		if (c == 'm') {
+			dump_kmalloc_stats();
+		}
 	}
 
 	if (c == 0x19) { /* ctrl-y */
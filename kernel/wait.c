@@ -1,3 +1,4 @@
+#include <sched.h>
 #include <wait.h>
 
 void wake_up(struct wait_queue_head *wq_head)
@@ -0,0 +1,204 @@
+#include <arch.h>
+#include <printk.h>
+#include <percpu.h>
+#include <spinlock.h>
+#include <sched.h>
+#include <timer.h>
+#include <hw_timer.h>
+#include <workqueue.h>
+
+/*
+ * One pool per cpu, served by one worker thread bound to the cpu. The worker
+ * sleeps while its list is empty; queueing work on the pool wakes it.
+ */
+struct worker_pool {
+	struct spinlock lock;
+	struct list_head worklist;
+	struct task_struct *worker;	/* NULL until the worker has started. */
+	unsigned int nr_queued;
+	unsigned int nr_executed;
+	unsigned int nr_wakeups;
+	unsigned int nr_delayed;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pools);
+
+/* work is pending already, adds it to the pool of cpu. */
+static void __queue_work(int cpu, struct work_struct *work)
+{
+	struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+	struct task_struct *wake = NULL;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&pool->lock);
+	list_add_tail(&work->entry, &pool->worklist);
+	pool->nr_queued++;
+	if (pool->worker != NULL && pool->worker->state == SLEEPING) {
+		wake = pool->worker;
+		pool->nr_wakeups++;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	/* The worker sets itself SLEEPING with pool->lock held. */
+	if (wake != NULL) {
+		set_task_state(wake, RUNNING);
+	}
+}
+
+static int test_and_set_pending(struct work_struct *work)
+{
+	return __atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL);
+}
+
+int queue_work_on(int cpu, struct work_struct *work)
+{
+	if (work == NULL || work->func == NULL) {
+		printk("%s: work or its function is null\n", __FUNCTION__);
+		return -1;
+	}
+	if (cpu < 0 || cpu >= NUM_CPUS) {
+		printk("%s: cpu is invalid, cpu=%d\n", __FUNCTION__, cpu);
+		return -1;
+	}
+
+	if (test_and_set_pending(work)) {
+		return false;
+	}
+	__queue_work(cpu, work);
+
+	return true;
+}
+
+int schedule_work(struct work_struct *work)
+{
+	return queue_work_on(get_cpu_core_id(), work);
+}
+
+static void delayed_work_timer_fn(unsigned long data)
+{
+	struct delayed_work *dwork = (struct delayed_work *)data;
+
+	__queue_work(dwork->cpu, &dwork->work);
+}
+
+int queue_delayed_work_on(int cpu, struct delayed_work *dwork,
+			  unsigned long delay)
+{
+	if (dwork == NULL || dwork->work.func == NULL) {
+		printk("%s: dwork or its function is null\n", __FUNCTION__);
+		return -1;
+	}
+	if (cpu < 0 || cpu >= NUM_CPUS) {
+		printk("%s: cpu is invalid, cpu=%d\n", __FUNCTION__, cpu);
+		return -1;
+	}
+
+	if (test_and_set_pending(&dwork->work)) {
+		return false;
+	}
+
+	if (delay == 0) {
+		__queue_work(cpu, &dwork->work);
+		return true;
+	}
+
+	per_cpu(worker_pools, cpu).nr_delayed++;
+	dwork->cpu = cpu;
+	dwork->timer.function = delayed_work_timer_fn;
+	dwork->timer.data = (unsigned long)dwork;
+	dwork->timer.expires = get_tick() + delay;
+	add_timer(&dwork->timer);
+
+	return true;
+}
+
+int schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	return queue_delayed_work_on(get_cpu_core_id(), dwork, delay);
+}
+
+static int worker_thread(void *arg)
+{
+	int cpu = (int)(long)arg;
+	struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+	struct task_struct *current = get_current_proc();
+	struct sched_param param = { .sched_priority = WORKER_RT_PRIO };
+	struct work_struct *work;
+	unsigned long flags;
+
+	if (sched_setscheduler(current, SCHED_FIFO, &param) < 0) {
+		printk("%s: sched_setscheduler failed\n", __FUNCTION__);
+	}
+	/* A running task leaves its cpu at its next switch. */
+	set_cpus_allowed(current, (cpumask_t)1 << cpu);
+
+	flags = spin_lock_irqsave(&pool->lock);
+	pool->worker = current;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	while (true) {
+		flags = spin_lock_irqsave(&pool->lock);
+		if (list_empty(&pool->worklist)) {
+			set_task_state(current, SLEEPING);
+			spin_unlock_irqrestore(&pool->lock, flags);
+			schedule();
+			continue;
+		}
+		work = list_first_entry(&pool->worklist, struct work_struct,
+					entry);
+		list_del_init(&work->entry);
+		/* The function may queue the work again. */
+		__atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+		pool->nr_executed++;
+		spin_unlock_irqrestore(&pool->lock, flags);
+
+		work->func(work);
+	}
+
+	return 0;
+}
+
+/* Work may be queued once this returned, it runs once create_workers() did. */
+void init_workqueues(void)
+{
+	struct worker_pool *pool;
+	int cpu;
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		pool = &per_cpu(worker_pools, cpu);
+		spin_lock_init(&pool->lock);
+		INIT_LIST_HEAD(&pool->worklist);
+		pool->worker = NULL;
+	}
+}
+
+int create_workers(void)
+{
+	char name[] = "kworker/0";
+	int cpu;
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		name[sizeof (name) - 2] = '0' + cpu;
+		if (kernel_thread(name, worker_thread, (void *)(long)cpu) < 0) {
+			printk("%s: kernel_thread failed for cpu%d\n",
+			       __FUNCTION__, cpu);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void dump_workqueue_stats(void)
+{
+	struct worker_pool *pool;
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		pool = &per_cpu(worker_pools, i);
+		printk("cpu%d: work queued=%d, executed=%d, delayed=%d, wakeups=%d, worker pid=%d\n",
+		       i, pool->nr_queued, pool->nr_executed, pool->nr_delayed,
+		       pool->nr_wakeups,
+		       (pool->worker != NULL) ? pool->worker->pid : -1);
+	}
+}
@@ -0,0 +1,329 @@
+#include <rbtree.h>
+
+/* re. lib/rbtree.c of Linux 2.6 */
+
+static void __rb_rotate_left(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *right = node->rb_right;
+	struct rb_node *parent = node->rb_parent;
+
+	node->rb_right = right->rb_left;
+	if (node->rb_right != NULL) {
+		right->rb_left->rb_parent = node;
+	}
+	right->rb_left = node;
+
+	right->rb_parent = parent;
+
+	if (parent != NULL) {
+		if (node == parent->rb_left) {
+			parent->rb_left = right;
+		} else {
+			parent->rb_right = right;
+		}
+	} else {
+		root->rb_node = right;
+	}
+	node->rb_parent = right;
+}
+
+static void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *left = node->rb_left;
+	struct rb_node *parent = node->rb_parent;
+
+	node->rb_left = left->rb_right;
+	if (node->rb_left != NULL) {
+		left->rb_right->rb_parent = node;
+	}
+	left->rb_right = node;
+
+	left->rb_parent = parent;
+
+	if (parent != NULL) {
+		if (node == parent->rb_right) {
+			parent->rb_right = left;
+		} else {
+			parent->rb_left = left;
+		}
+	} else {
+		root->rb_node = left;
+	}
+	node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *parent, *gparent;
+
+	while ((parent = node->rb_parent) != NULL &&
+	       parent->rb_color == RB_RED) {
+		gparent = parent->rb_parent;
+
+		if (parent == gparent->rb_left) {
+			struct rb_node *uncle = gparent->rb_right;
+
+			if (uncle != NULL && uncle->rb_color == RB_RED) {
+				uncle->rb_color = RB_BLACK;
+				parent->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (parent->rb_right == node) {
+				struct rb_node *tmp;
+
+				__rb_rotate_left(parent, root);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_right(gparent, root);
+		} else {
+			struct rb_node *uncle = gparent->rb_left;
+
+			if (uncle != NULL && uncle->rb_color == RB_RED) {
+				uncle->rb_color = RB_BLACK;
+				parent->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (parent->rb_left == node) {
+				struct rb_node *tmp;
+
+				__rb_rotate_right(parent, root);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_left(gparent, root);
+		}
+	}
+
+	root->rb_node->rb_color = RB_BLACK;
+}
+
+static int is_black(const struct rb_node *node)
+{
+	return (node == NULL || node->rb_color == RB_BLACK);
+}
+
+static void __rb_erase_color(struct rb_node *node, struct rb_node *parent,
+			     struct rb_root *root)
+{
+	struct rb_node *other;
+
+	while (is_black(node) && node != root->rb_node) {
+		if (parent->rb_left == node) {
+			other = parent->rb_right;
+			if (other->rb_color == RB_RED) {
+				other->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_left(parent, root);
+				other = parent->rb_right;
+			}
+			if (is_black(other->rb_left) && is_black(other->rb_right)) {
+				other->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+			} else {
+				if (is_black(other->rb_right)) {
+					other->rb_left->rb_color = RB_BLACK;
+					other->rb_color = RB_RED;
+					__rb_rotate_right(other, root);
+					other = parent->rb_right;
+				}
+				other->rb_color = parent->rb_color;
+				parent->rb_color = RB_BLACK;
+				other->rb_right->rb_color = RB_BLACK;
+				__rb_rotate_left(parent, root);
+				node = root->rb_node;
+				break;
+			}
+		} else {
+			other = parent->rb_left;
+			if (other->rb_color == RB_RED) {
+				other->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_right(parent, root);
+				other = parent->rb_left;
+			}
+			if (is_black(other->rb_left) && is_black(other->rb_right)) {
+				other->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+			} else {
+				if (is_black(other->rb_left)) {
+					other->rb_right->rb_color = RB_BLACK;
+					other->rb_color = RB_RED;
+					__rb_rotate_left(other, root);
+					other = parent->rb_left;
+				}
+				other->rb_color = parent->rb_color;
+				parent->rb_color = RB_BLACK;
+				other->rb_left->rb_color = RB_BLACK;
+				__rb_rotate_right(parent, root);
+				node = root->rb_node;
+				break;
+			}
+		}
+	}
+
+	if (node != NULL) {
+		node->rb_color = RB_BLACK;
+	}
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *child, *parent;
+	int color;
+
+	if (node->rb_left == NULL) {
+		child = node->rb_right;
+	} else if (node->rb_right == NULL) {
+		child = node->rb_left;
+	} else {
+		struct rb_node *old = node, *left;
+
+		/* Replace the node by its successor. */
+		node = node->rb_right;
+		while ((left = node->rb_left) != NULL) {
+			node = left;
+		}
+
+		if (old->rb_parent != NULL) {
+			if (old->rb_parent->rb_left == old) {
+				old->rb_parent->rb_left = node;
+			} else {
+				old->rb_parent->rb_right = node;
+			}
+		} else {
+			root->rb_node = node;
+		}
+
+		child = node->rb_right;
+		parent = node->rb_parent;
+		color = node->rb_color;
+
+		if (parent == old) {
+			parent = node;
+		} else {
+			if (child != NULL) {
+				child->rb_parent = parent;
+			}
+			parent->rb_left = child;
+
+			node->rb_right = old->rb_right;
+			old->rb_right->rb_parent = node;
+		}
+
+		node->rb_parent = old->rb_parent;
+		node->rb_color = old->rb_color;
+		node->rb_left = old->rb_left;
+		old->rb_left->rb_parent = node;
+
+		goto color;
+	}
+
+	parent = node->rb_parent;
+	color = node->rb_color;
+
+	if (child != NULL) {
+		child->rb_parent = parent;
+	}
+	if (parent != NULL) {
+		if (parent->rb_left == node) {
+			parent->rb_left = child;
+		} else {
+			parent->rb_right = child;
+		}
+	} else {
+		root->rb_node = child;
+	}
+
+color:
+	if (color == RB_BLACK) {
+		__rb_erase_color(child, parent, root);
+	}
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+	struct rb_node *n = root->rb_node;
+
+	if (n == NULL) {
+		return NULL;
+	}
+	while (n->rb_left != NULL) {
+		n = n->rb_left;
+	}
+
+	return n;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+	struct rb_node *n = root->rb_node;
+
+	if (n == NULL) {
+		return NULL;
+	}
+	while (n->rb_right != NULL) {
+		n = n->rb_right;
+	}
+
+	return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	/* If we have a right-hand child, go down and then left as far as we can. */
+	if (node->rb_right != NULL) {
+		node = node->rb_right;
+		while (node->rb_left != NULL) {
+			node = node->rb_left;
+		}
+		return (struct rb_node *)node;
+	}
+
+	/*
+	 * No right-hand children, go up till we find an ancestor which is a
+	 * left-hand child of its parent.
+	 */
+	while ((parent = node->rb_parent) != NULL && node == parent->rb_right) {
+		node = parent;
+	}
+
+	return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	if (node->rb_left != NULL) {
+		node = node->rb_left;
+		while (node->rb_right != NULL) {
+			node = node->rb_right;
+		}
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) != NULL && node == parent->rb_left) {
+		node = parent;
+	}
+
+	return parent;
+}
@@ -0,0 +1,163 @@
+#include <arch.h>
+#include <printk.h>
+#include <percpu.h>
+#include <string.h>
+#include <spinlock.h>
+#include <bitops.h>
+#include <mmu_context.h>
+
+static unsigned int asid_bits;
+u64 asid_mask;
+static u64 asid_generation;
+
+#define ASID_FIRST_VERSION (1UL << asid_bits)
+#define NUM_USER_ASIDS ASID_FIRST_VERSION
+
+/* ASID 0 is never given out, TTBR0_EL1 has it with no user table loaded. */
+static DECLARE_BITMAP(asid_map, 1 << 16);
+static unsigned int cur_idx = 1;
+static struct spinlock cpu_asid_lock;
+
+/*
+ * active_asids is the ASID running on the cpu, or 0 once a rollover took
+ * it; reserved_asids keeps it through rollovers until the cpu switches.
+ */
+static DEFINE_PER_CPU(u64, active_asids);
+static DEFINE_PER_CPU(u64, reserved_asids);
+static DEFINE_PER_CPU(int, tlb_flush_pending);
+
+static unsigned int asid_rollovers;
+static unsigned int asid_allocs;
+static DEFINE_PER_CPU(unsigned int, asid_tlb_flushes);
+
+/* Called by cpu0 before the other cpus start. */
+void init_asids(void)
+{
+	asid_bits = cpu_asid_bits();
+	asid_mask = (1UL << asid_bits) - 1;
+	asid_generation = ASID_FIRST_VERSION;
+	spin_lock_init(&cpu_asid_lock);
+	printk("%s: %d bit ASIDs\n", __FUNCTION__, asid_bits);
+}
+
+/* New generation: only the ASIDs running on some cpu are kept. */
+static void flush_context(void)
+{
+	u64 asid;
+	int i;
+
+	memset(asid_map, 0, sizeof (asid_map));
+	for (i = 0; i < NUM_CPUS; i++) {
+		asid = __atomic_exchange_n(&per_cpu(active_asids, i), 0,
+					   __ATOMIC_RELAXED);
+		if (asid == 0) {
+			asid = per_cpu(reserved_asids, i);
+		}
+		__set_bit(asid & asid_mask, asid_map);
+		per_cpu(reserved_asids, i) = asid;
+		per_cpu(tlb_flush_pending, i) = true;
+	}
+	asid_rollovers++;
+}
+
+static int check_update_reserved_asid(u64 asid, u64 newasid)
+{
+	int hit = false;
+	int i;
+
+	for (i = 0; i < NUM_CPUS; i++) {
+		if (per_cpu(reserved_asids, i) == asid) {
+			per_cpu(reserved_asids, i) = newasid;
+			hit = true;
+		}
+	}
+
+	return hit;
+}
+
+/* cpu_asid_lock is held. */
+static u64 new_context(struct mm_struct *mm)
+{
+	u64 asid = mm->context.id;
+	u64 generation = asid_generation;
+
+	if (asid != 0) {
+		u64 newasid = generation | (asid & asid_mask);
+
+		/* Running somewhere at the rollover, it stays reserved. */
+		if (check_update_reserved_asid(asid, newasid)) {
+			return newasid;
+		}
+
+		/* Reuse the old ASID if it's still free. */
+		if (!test_bit(asid & asid_mask, asid_map)) {
+			__set_bit(asid & asid_mask, asid_map);
+			return newasid;
+		}
+	}
+
+	asid = find_next_zero_bit(asid_map, NUM_USER_ASIDS, cur_idx);
+	if (asid == NUM_USER_ASIDS) {
+		generation += ASID_FIRST_VERSION;
+		asid_generation = generation;
+		flush_context();
+		asid = find_next_zero_bit(asid_map, NUM_USER_ASIDS, 1);
+	}
+
+	__set_bit(asid, asid_map);
+	cur_idx = asid;
+	asid_allocs++;
+
+	return asid | generation;
+}
+
+/*
+ * Makes sure mm has an ASID of the current generation before it's loaded on
+ * cpu, irqs are disabled. The fast path takes no lock, the cmpxchg fails if a
+ * rollover took the active ASID meanwhile.
+ */
+void check_and_switch_context(struct mm_struct *mm, int cpu)
+{
+	u64 asid = mm->context.id;
+	u64 old_active_asid;
+
+	old_active_asid = __atomic_load_n(&per_cpu(active_asids, cpu),
+					  __ATOMIC_RELAXED);
+	if (old_active_asid != 0 &&
+	    ((asid ^ asid_generation) >> asid_bits) == 0 &&
+	    __atomic_compare_exchange_n(&per_cpu(active_asids, cpu),
+					&old_active_asid, asid, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	arch_spin_lock(&cpu_asid_lock);
+	asid = mm->context.id;
+	if (((asid ^ asid_generation) >> asid_bits) != 0) {
+		asid = new_context(mm);
+		mm->context.id = asid;
+	}
+
+	if (per_cpu(tlb_flush_pending, cpu)) {
+		per_cpu(tlb_flush_pending, cpu) = false;
+		per_cpu(asid_tlb_flushes, cpu)++;
+		invalidate_tlb();
+	}
+
+	__atomic_store_n(&per_cpu(active_asids, cpu), asid, __ATOMIC_RELAXED);
+	arch_spin_unlock(&cpu_asid_lock);
+}
+
+void dump_asid_stats(void)
+{
+	int i;
+
+	printk("asid_bits=%d, generation=%p, allocs=%d, rollovers=%d\n",
+	       asid_bits, asid_generation >> asid_bits, asid_allocs,
+	       asid_rollovers);
+	for (i = 0; i < NUM_CPUS; i++) {
+		printk("cpu%d: active_asid=%p, reserved_asid=%p, tlb_flushes=%d\n",
+		       i, per_cpu(active_asids, i), per_cpu(reserved_asids, i),
+		       per_cpu(asid_tlb_flushes, i));
+	}
+}
@@ -3,6 +3,7 @@
 #include <printk.h>
 #include <hardware.h>
 #include <spinlock.h>
+#include <percpu.h>
 
 #define IN_KERNEL
 #include "mm.c"
@@ -10,6 +11,34 @@
 static struct mem_pool kmalloc_pool;
 static struct spinlock kmalloc_lock;
 
+/*
+ * Each cpu keeps a magazine of free blocks per size class, used with irqs
+ * disabled. An empty one is refilled and a full one flushed
+ * KMALLOC_MAG_BATCH blocks at a time under kmalloc_lock.
+ */
+#define NR_KMALLOC_CLASSES 7
+#define KMALLOC_MAG_SIZE 16
+#define KMALLOC_MAG_BATCH (KMALLOC_MAG_SIZE / 2)
+
+static const size_t kmalloc_sizes[NR_KMALLOC_CLASSES] = {
+	32, 64, 128, 256, 512, 1024, 2048
+};
+
+struct kmalloc_magazine {
+	unsigned int avail;
+	void *objs[KMALLOC_MAG_SIZE];
+};
+
+struct kmalloc_cpu_cache {
+	struct kmalloc_magazine mags[NR_KMALLOC_CLASSES];
+	unsigned int nr_alloc_hits;
+	unsigned int nr_alloc_refills;
+	unsigned int nr_free_hits;
+	unsigned int nr_free_flushes;
+};
+
+static DEFINE_PER_CPU(struct kmalloc_cpu_cache, kmalloc_cpu_caches);
+
 static void *kernel_mock_sbrk(intptr_t increment)
 {
 	static void *last = (void *)MEM_POOL_START;
@@ -26,6 +55,17 @@ static void *kernel_mock_sbrk(intptr_t increment)
 	}
 }
 
+/* Large kmalloc() blocks are whole pages of the page pool. */
+static void *kmalloc_alloc_pages(size_t size)
+{
+	return get_free_pages(get_order(size));
+}
+
+static void kmalloc_free_pages(void *addr, size_t size)
+{
+	free_pages(addr, get_order(size));
+}
+
 void init_kmalloc_free(void)
 {
 	/* To suppress get_pool_malloc_total_length defined but not used warning. */
@@ -40,15 +80,61 @@ void init_kmalloc_free(void)
 
 	init_mm(&kmalloc_pool,
 		&kernel_mock_sbrk,
+		kmalloc_alloc_pages,
+		kmalloc_free_pages,
 		&kmalloc_lock,
 		(void (*)(void *lock))&spin_lock_init,
 		(void (*)(void *lock))&spin_lock,
 		(void (*)(void *lock))&spin_unlock);
 }
 
+/* The size classes of the per-cpu magazines. */
+static int kmalloc_index(size_t size)
+{
+	int i;
+
+	if (size == 0) {
+		return -1;
+	}
+	for (i = 0; i < NR_KMALLOC_CLASSES; i++) {
+		if (size <= kmalloc_sizes[i]) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* A small request is rounded up to its class, see kfree(). */
 void *kmalloc(size_t size)
 {
-	return alloc_mem(&kmalloc_pool, size);
+	struct kmalloc_cpu_cache *cc;
+	struct kmalloc_magazine *mag;
+	void *obj = NULL;
+	unsigned long flags;
+	int class;
+
+	class = kmalloc_index(size);
+	if (class < 0) {
+		return alloc_mem(&kmalloc_pool, size);
+	}
+
+	local_irq_save(flags);
+	cc = &per_cpu(kmalloc_cpu_caches, get_cpu_core_id());
+	mag = &cc->mags[class];
+	if (mag->avail == 0) {
+		mag->avail = alloc_mem_bulk(&kmalloc_pool, kmalloc_sizes[class],
+					    mag->objs, KMALLOC_MAG_BATCH);
+		cc->nr_alloc_refills++;
+	} else {
+		cc->nr_alloc_hits++;
+	}
+	if (mag->avail > 0) {
+		obj = mag->objs[--mag->avail];
+	}
+	local_irq_restore(flags);
+
+	return obj;
 }
 
 void *kzalloc(size_t size)
@@ -66,104 +152,64 @@ void *kzalloc(size_t size)
 
 void kfree(void *user_start)
 {
-	free_mem(&kmalloc_pool, user_start);
-}
-
-#define MAX_NUM_PAGES (PAGE_POOL_SIZE / PAGE_SIZE)
-static char pages_usage[MAX_NUM_PAGES];
-
-static int find_free_pages(unsigned int num)
-{
-	int i;
-	int first_page;
-	int last_page = -1;
-
-#ifdef DEBUG_MEMORY_ALLOCATION
-	printk("num=%d\n", num);
-#endif
-	if (num == 0) {
-		return -1;
-	}
-
-	for (int free_count = 0, i = 0; i < MAX_NUM_PAGES; i++) {
-		if (pages_usage[i] == 0) {
-			free_count++;
-			if (free_count == num) {
-				last_page = i;
-				break;
-			}
-		} else {
-			free_count = 0;
-		}
+	struct kmalloc_cpu_cache *cc;
+	struct kmalloc_magazine *mag;
+	struct mem_blk *mem_blk;
+	unsigned long flags;
+	int class;
+
+	if (user_start == NULL || is_large_mem(&kmalloc_pool, user_start)) {
+		free_mem(&kmalloc_pool, user_start);
+		return;
 	}
 
-	if (last_page < 0) {
-		return -1;
+	mem_blk = user_start - sizeof (struct mem_blk);
+	if (!mem_blk_ok(mem_blk, MEM_BLK_IN_USE)) {
+		printk("Invalid memory pointer to free: %p\n", user_start);
+		return;
 	}
-
-	first_page = last_page - num + 1;
-#ifdef DEBUG_MEMORY_ALLOCATION
-	printk("first_page=%d, last_page=%d\n", first_page, last_page);
-#endif
-	for (i = first_page; i <= last_page; i++) {
-		pages_usage[i] = 1;
+	/* A block of a class has exactly the size of its class. */
+	class = kmalloc_index(mem_blk->user_len);
+	if (class < 0 || mem_blk->user_len != kmalloc_sizes[class]) {
+		free_mem(&kmalloc_pool, user_start);
+		return;
 	}
 
-	return first_page;
-}
-
-void *get_free_pages(unsigned int order)
-{
-	unsigned int num = (1 << order);
-
-	int first_page = find_free_pages(num);
-
-	if (first_page >= 0) {
-		return (void *)(unsigned long)(PAGE_POOL_START
-					       + PAGE_SIZE * first_page);
+	local_irq_save(flags);
+	cc = &per_cpu(kmalloc_cpu_caches, get_cpu_core_id());
+	mag = &cc->mags[class];
+	if (mag->avail == KMALLOC_MAG_SIZE) {
+		/* The oldest blocks go back, the recent ones are cache hot. */
+		free_mem_bulk(&kmalloc_pool, mag->objs, KMALLOC_MAG_BATCH);
+		mag->avail -= KMALLOC_MAG_BATCH;
+		memcpy(&mag->objs[0], &mag->objs[KMALLOC_MAG_BATCH],
+		       mag->avail * sizeof (void *));
+		cc->nr_free_flushes++;
 	} else {
-		return NULL;
-	}
-}
-
-void *get_zeroed_pages(unsigned int order)
-{
-	void *pages;
-
-	pages = get_free_pages(order);
-
-	if (pages != NULL) {
-		memset(pages, 0, (PAGE_SIZE * (1 << order)));
+		cc->nr_free_hits++;
 	}
-
-	return pages;
+	mag->objs[mag->avail++] = user_start;
+	local_irq_restore(flags);
 }
 
-void free_pages(void *addr, unsigned int order)
+void dump_kmalloc_stats(void)
 {
+	struct kmalloc_cpu_cache *cc;
+	unsigned int cached;
+	int cpu;
 	int i;
-	int first_page;
-	int num = (1 << order);
-
-	if ((unsigned long)addr < PAGE_POOL_START
-			|| (unsigned long)addr >= PAGE_POOL_END) {
-		printk("Error in %s: addr=%p\n", __FUNCTION__, addr);
-		return;
-	}
-
-	if (((unsigned long)addr & (PAGE_SIZE - 1)) != 0) {
-		printk("Error in %s: addr=%p is not page-aligned.\n",
-		       __FUNCTION__, addr);
-		return;
-	}
 
-	first_page = ((unsigned long)addr - PAGE_POOL_START) / PAGE_SIZE;
-	for (i = 0; i < num; i++) {
-		if (pages_usage[first_page + i] != 1) {
-			printk("Error in %s: addr=%p, order=%u, first_page=%d, i=%d, pages_usage=%d\n",
-			       __FUNCTION__, addr, order, first_page, i, pages_usage[first_page + i]);
-			assert(0);
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		cc = &per_cpu(kmalloc_cpu_caches, cpu);
+		cached = 0;
+		for (i = 0; i < NR_KMALLOC_CLASSES; i++) {
+			cached += cc->mags[i].avail;
 		}
-		pages_usage[first_page + i] = 0;
+		printk("cpu%d: kmalloc hits=%d, refills=%d, kfree hits=%d, flushes=%d, cached blocks=%d\n",
+		       cpu, cc->nr_alloc_hits, cc->nr_alloc_refills,
+		       cc->nr_free_hits, cc->nr_free_flushes, cached);
 	}
+	printk("kmalloc pool: start=%p, end=%p, total_length=%d\n",
+	       kmalloc_pool.start, kmalloc_pool.end,
+	       (u32)kmalloc_pool.total_length);
 }
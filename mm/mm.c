@@ -1,6 +1,7 @@
 #include <stddef.h>
 #include <mm.h>
 #include <string.h>
+#include <list.h>
 
 #if defined IN_KERNEL
 #include <printk.h>
@@ -10,13 +11,25 @@
 #define PRINT printf
 #endif
 
+/*
+ * Segregated-fit allocator. Every block of the pool has a header and a tail
+ * pointing back to it (boundary tags), so the neighbours of a freed block are
+ * found in O(1) and merged with it. Free blocks are kept in bins by size:
+ * 16-byte steps below SMALL_BIN_LIMIT, then one bin per power of two, with a
+ * bitmap of the non-empty bins. A request takes a fitting block of its own
+ * bin or the first block of the next non-empty bin, and the rest is split
+ * off. Requests of at least LARGE_BLK_LEN go to whole pages when the pool
+ * has a page allocator.
+ */
+
 enum { MEM_BLK_MAGIC = 0xABCD1234 };
 
+enum { MEM_BLK_FREE, MEM_BLK_IN_USE, MEM_BLK_LARGE };
+
 struct mem_blk {
 	int magic_num;
 	int in_use;
 	size_t blk_len;
-	void *user_start;
 	size_t user_len;
 };
 
@@ -24,6 +37,15 @@ struct mem_blk_tail {
 	struct mem_blk *header;
 };
 
+#define SMALL_BIN_SHIFT 4
+#define SMALL_BIN_LIMIT (NR_SMALL_BINS << SMALL_BIN_SHIFT)
+
+/* A free block holds its bin links after the header. */
+#define MIN_BLK_LEN (sizeof (struct mem_blk) + sizeof (struct list_head) \
+		     + sizeof (struct mem_blk_tail))
+
+#define LARGE_BLK_LEN (4 * PAGE_SIZE)
+
 static struct mem_blk_tail *get_tail(const struct mem_blk *p)
 {
 	struct mem_blk_tail *tail;
@@ -34,21 +56,32 @@ static struct mem_blk_tail *get_tail(const struct mem_blk *p)
 	return tail;
 }
 
+static void *get_user_start(const struct mem_blk *p)
+{
+	return (void *)p + sizeof (struct mem_blk);
+}
+
+static struct list_head *get_links(const struct mem_blk *p)
+{
+	return (struct list_head *)get_user_start(p);
+}
+
+static struct mem_blk *links_to_blk(const struct list_head *links)
+{
+	return (struct mem_blk *)((void *)links - sizeof (struct mem_blk));
+}
+
+/* The contents are left as they are, calloc() and kzalloc() clear memory. */
 static void init_free_blk(void *p, size_t size)
 {
 	struct mem_blk *free_mem;
-	int i;
 
 	free_mem = (struct mem_blk *)p;
 
-	/* For memset/user_memset */
-	for (i = 0; i < size; i++) {
-		*((uint8_t *)free_mem + i) = 0;
-	}
-
 	free_mem->magic_num = MEM_BLK_MAGIC;
-	free_mem->in_use = 0;
+	free_mem->in_use = MEM_BLK_FREE;
 	free_mem->blk_len = size;
+	free_mem->user_len = 0;
 	get_tail(free_mem)->header = free_mem;
 }
 
@@ -58,7 +91,7 @@ static void dump_mem_blk(const struct mem_blk *p)
 	PRINT("magic_num=%x\n", p->magic_num);
 	PRINT("in_use=%d\n", p->in_use);
 	PRINT("blk_len=%u\n", p->blk_len);
-	PRINT("user_start=%p\n", p->user_start);
+	PRINT("user_start=%p\n", get_user_start(p));
 	PRINT("user_len=%u\n", p->user_len);
 }
 
@@ -91,61 +124,79 @@ static struct mem_blk *next_mem_blk(const struct mem_pool *pool,
 	return header;
 }
 
-/* Whether the memory block is big enough */
-static int big_mem_blk(const struct mem_blk *p, size_t size)
+static int is_blk_free(const struct mem_blk *p)
 {
-	size_t user_avail;
+	return (p->in_use == MEM_BLK_FREE);
+}
 
-	user_avail = p->blk_len - sizeof (struct mem_blk)
-		- sizeof (struct mem_blk_tail);
-	if (user_avail >= size) {
-		return true;
-	} else {
-		return false;
+static unsigned int bin_index(size_t blk_len)
+{
+	unsigned int idx;
+
+	if (blk_len < SMALL_BIN_LIMIT) {
+		return blk_len >> SMALL_BIN_SHIFT;
 	}
+
+	/* Highest bit set, SMALL_BIN_LIMIT is a power of two. */
+	idx = NR_SMALL_BINS + __builtin_clzll(SMALL_BIN_LIMIT)
+		- __builtin_clzll(blk_len);
+
+	return (idx < NR_BINS) ? idx : (NR_BINS - 1);
 }
 
-static int is_blk_free(const struct mem_blk *p)
+static void link_free_blk(struct mem_pool *pool, struct mem_blk *p)
 {
-	return (p->in_use == 0);
+	unsigned int idx = bin_index(p->blk_len);
+
+	list_add(get_links(p), &pool->bins[idx]);
+	pool->binmap |= (1ULL << idx);
 }
 
+static void unlink_free_blk(struct mem_pool *pool, struct mem_blk *p)
+{
+	unsigned int idx = bin_index(p->blk_len);
+
+	list_del(get_links(p));
+	if (list_empty(&pool->bins[idx])) {
+		pool->binmap &= ~(1ULL << idx);
+	}
+}
+
+/* free is not in a bin, its neighbours are never free together with it. */
 static void merge_free_blk(struct mem_pool *pool, struct mem_blk *free)
 {
-	struct mem_blk *p;
-	struct mem_blk *most_prev = free;
-	struct mem_blk *most_next = free;
+	struct mem_blk *prev;
+	struct mem_blk *next;
 
-	for (p = free; p != NULL; p = prev_mem_blk(pool, p)) {
-		if (is_blk_free(p)) {
-			most_prev = p;
-		} else {
-			break;
-		}
+	prev = prev_mem_blk(pool, free);
+	if (prev != NULL && is_blk_free(prev)) {
+		unlink_free_blk(pool, prev);
+		init_free_blk(prev, prev->blk_len + free->blk_len);
+		free = prev;
 	}
 
-	for (p = free; p != NULL; p = next_mem_blk(pool, p)) {
-		if (is_blk_free(p)) {
-			most_next = p;
-		} else {
-			break;
-		}
+	next = next_mem_blk(pool, free);
+	if (next != NULL && is_blk_free(next)) {
+		unlink_free_blk(pool, next);
+		init_free_blk(free, free->blk_len + next->blk_len);
 	}
 
 #ifdef DEBUG_MEMORY_ALLOCATION
-	PRINT("most_prev=%p\n", most_prev);
-	PRINT("most_next=%p\n", most_next);
+	PRINT("merged free block=%p, blk_len=%u\n", free, free->blk_len);
 #endif
-	init_free_blk(most_prev,
-		      (size_t)most_next + most_next->blk_len
-		      - (size_t)most_prev);
+	link_free_blk(pool, free);
 }
 
-static int enlarge_mem_pool(struct mem_pool *p)
+/* The pool at least doubles, so that it grows a logarithmic number of times. */
+static int enlarge_mem_pool(struct mem_pool *p, size_t blk_len)
 {
 	void *ret;
 	size_t increment = (size_t)(p->end - p->start);
 
+	if (increment < blk_len) {
+		increment = blk_len;
+	}
+
 	ret = p->sbrk_func(increment);
 	if (ret == (void *)-1) {
 		return -1;
@@ -160,20 +211,35 @@ static int enlarge_mem_pool(struct mem_pool *p)
 	return 0;
 }
 
-/* Search the block pool for a big enough block. */
-static struct mem_blk *find_a_free_blk(struct mem_pool *pool, size_t size)
+/*
+ * A block of the own bin may be too small, the first block of a larger bin
+ * always fits.
+ */
+static struct mem_blk *find_a_free_blk(struct mem_pool *pool, size_t blk_len)
 {
+	unsigned int idx = bin_index(blk_len);
+	unsigned long long larger_bins;
+	struct list_head *pos;
 	struct mem_blk *p;
 
-	for (p = (struct mem_blk *)pool->start; p != NULL;
-	     p = next_mem_blk(pool, p)) {
-		if (p->in_use == 0 && big_mem_blk(p, size)) {
-			return p;
+	if (pool->binmap & (1ULL << idx)) {
+		for (pos = pool->bins[idx].next; pos != &pool->bins[idx];
+		     pos = pos->next) {
+			p = links_to_blk(pos);
+			if (p->blk_len >= blk_len) {
+				return p;
+			}
 		}
 	}
 
-	if (enlarge_mem_pool(pool) == 0) {
-		return find_a_free_blk(pool, size);
+	larger_bins = pool->binmap & ~((2ULL << idx) - 1);
+	if (larger_bins != 0) {
+		idx = __builtin_ctzll(larger_bins);
+		return links_to_blk(pool->bins[idx].next);
+	}
+
+	if (enlarge_mem_pool(pool, blk_len) == 0) {
+		return find_a_free_blk(pool, blk_len);
 	} else {
 		return NULL;
 	}
@@ -183,34 +249,27 @@ static struct mem_blk *find_a_free_blk(struct mem_pool *pool, size_t size)
  * Whether the memory block should be splitted into two blocks.
  * (one block for allocation and one new free block)
  */
-static int should_split(const struct mem_blk *p, size_t size)
+static int should_split(const struct mem_blk *p, size_t blk_len)
 {
-	if (p->blk_len > sizeof (*p) + size + sizeof (struct mem_blk_tail)
-			+ sizeof (*p) + sizeof (struct mem_blk_tail)) {
-		/* The remaining space is bigger than the size of memory header. */
-		return true;
-	} else {
-		return false;
-	}
+	return (p->blk_len >= blk_len + MIN_BLK_LEN);
 }
 
-/* Split a free memory block into two. */
-static void split_mem_blk(struct mem_pool *pool, struct mem_blk *p, size_t size)
+/* Split a free memory block, out of its bin, into two. */
+static void split_mem_blk(struct mem_pool *pool, struct mem_blk *p,
+			  size_t blk_len)
 {
 	struct mem_blk *next;
 	size_t old_blk_len;
-	size_t new_blk_len;
 
 	old_blk_len = p->blk_len;
-	new_blk_len = sizeof (struct mem_blk) + size +
-		sizeof (struct mem_blk_tail);
 #ifdef DEBUG_MEMORY_ALLOCATION
-	PRINT("new_blk_len=%u.\n", new_blk_len);
+	PRINT("new_blk_len=%u.\n", blk_len);
 #endif
 
-	init_free_blk(p, new_blk_len);
+	init_free_blk(p, blk_len);
 	next = next_mem_blk(pool, p);
-	init_free_blk(next, old_blk_len - new_blk_len);
+	init_free_blk(next, old_blk_len - blk_len);
+	link_free_blk(pool, next);
 
 #ifdef DEBUG_MEMORY_ALLOCATION
 	PRINT("Dumping newly created memory block by split.\n");
@@ -218,15 +277,15 @@ static void split_mem_blk(struct mem_pool *pool, struct mem_blk *p, size_t size)
 #endif
 }
 
-static void mark_mem_blk(struct mem_pool *pool, struct mem_blk *p, size_t size)
+static void mark_mem_blk(struct mem_pool *pool, struct mem_blk *p,
+			 size_t blk_len)
 {
-	if (should_split(p, size)) {
-		split_mem_blk(pool, p, size);
+	unlink_free_blk(pool, p);
+	if (should_split(p, blk_len)) {
+		split_mem_blk(pool, p, blk_len);
 	}
 
-	p->in_use = 1;
-	p->user_start = (void *)p + sizeof (struct mem_blk);
-	p->user_len = size;
+	p->in_use = MEM_BLK_IN_USE;
 
 #ifdef DEBUG_MEMORY_ALLOCATION
 	PRINT("Dumping marked memory block\n");
@@ -234,20 +293,16 @@ static void mark_mem_blk(struct mem_pool *pool, struct mem_blk *p, size_t size)
 #endif
 }
 
-/*
- * size is guaranteed by the caller to be aligned(4-bytes for 32bit system,
- * 8-bytes for 64bit system).
- */
-static struct mem_blk *get_mem_blk(struct mem_pool *pool, size_t size)
+static struct mem_blk *get_mem_blk(struct mem_pool *pool, size_t blk_len)
 {
 	struct mem_blk *p;
 
-	p = find_a_free_blk(pool, size);
+	p = find_a_free_blk(pool, blk_len);
 #ifdef DEBUG_MEMORY_ALLOCATION
 	PRINT("found a free block: %p\n", p);
 #endif
 	if (p != NULL) {
-		mark_mem_blk(pool, p, size);
+		mark_mem_blk(pool, p, blk_len);
 		return p;
 	} else {
 		return NULL;
@@ -269,8 +324,14 @@ static int is_mem_blk_aligned(void)
 	return ret;
 }
 
+/*
+ * page_alloc_func and page_free_func may be NULL, then large blocks are
+ * taken from the pool too.
+ */
 static void init_mm(struct mem_pool *cur_mem_pool,
 				void *sbrk_func(intptr_t),
+				void *(*page_alloc_func)(size_t size),
+				void (*page_free_func)(void *addr, size_t size),
 				void *lock,
 				void (*lock_init_func)(void *lock),
 				void (*lock_func)(void *lock),
@@ -278,6 +339,7 @@ static void init_mm(struct mem_pool *cur_mem_pool,
 {
 	void *start;
 	size_t initial_blk_len;
+	int i;
 
 	if (!is_mem_blk_aligned()) {
 		PRINT("Error: struct mem_blk is not aligned, there will be a gap between struct mem_blk and user_start\n");
@@ -285,9 +347,14 @@ static void init_mm(struct mem_pool *cur_mem_pool,
 	}
 
 	cur_mem_pool->sbrk_func = sbrk_func;
+	cur_mem_pool->page_alloc_func = page_alloc_func;
+	cur_mem_pool->page_free_func = page_free_func;
 	cur_mem_pool->total_length = 0;
-	initial_blk_len = (sizeof (struct mem_blk))
-		+ (sizeof (struct mem_blk_tail));
+	for (i = 0; i < NR_BINS; i++) {
+		INIT_LIST_HEAD(&cur_mem_pool->bins[i]);
+	}
+	cur_mem_pool->binmap = 0;
+	initial_blk_len = MIN_BLK_LEN;
 
 	start = cur_mem_pool->sbrk_func(initial_blk_len);
 	if (start == (void *)-1) {
@@ -297,6 +364,7 @@ static void init_mm(struct mem_pool *cur_mem_pool,
 	cur_mem_pool->end = start + initial_blk_len;
 
 	init_free_blk(start, initial_blk_len);
+	link_free_blk(cur_mem_pool, start);
 
 	cur_mem_pool->lock = lock;
 	cur_mem_pool->lock_init_func = lock_init_func;
@@ -321,13 +389,13 @@ static int mem_blk_magic_ok(const struct mem_blk *p)
 	return ret;
 }
 
-static int mem_blk_ok(const struct mem_blk *p)
+static int mem_blk_ok(const struct mem_blk *p, int in_use)
 {
 	if (!mem_blk_magic_ok(p)) {
 		return false;
 	}
 
-	if (p->in_use != 1) {
+	if (p->in_use != in_use) {
 		PRINT("Memory block is not in use.\n");
 		return false;
 	}
@@ -337,83 +405,166 @@ static int mem_blk_ok(const struct mem_blk *p)
 
 static void free_mem_blk(struct mem_pool *pool, struct mem_blk *p)
 {
-	p->in_use = 0;
+	p->in_use = MEM_BLK_FREE;
 
 	merge_free_blk(pool, p);
 }
 
-static void *alloc_mem(struct mem_pool *pool, size_t size)
+/* Whole pages with a header, outside of the pool. */
+static void *alloc_large_blk(struct mem_pool *pool, size_t blk_len,
+			     size_t size)
 {
-	size_t aligned_user_len;
 	struct mem_blk *p;
 
-#ifdef DEBUG_MEMORY_ALLOCATION
-	PRINT("%s: size=%u\n", __FUNCTION__, size);
-#endif
-
-	if (size == 0) {
+	p = pool->page_alloc_func(blk_len);
+	if (p == NULL) {
 		return NULL;
 	}
 
+	p->magic_num = MEM_BLK_MAGIC;
+	p->in_use = MEM_BLK_LARGE;
+	p->blk_len = blk_len;
+	p->user_len = size;
+
+	return get_user_start(p);
+}
+
+static size_t get_blk_len(size_t size)
+{
+	size_t blk_len;
+
 #ifdef ARM64
-	aligned_user_len = ALIGNED_TO_8BYTES(size);
+	blk_len = ALIGNED_TO_8BYTES(size);
 #else
-	aligned_user_len = ALIGNED_TO_4BYTES(size);
+	blk_len = ALIGNED_TO_4BYTES(size);
 #endif
+	blk_len += sizeof (struct mem_blk) + sizeof (struct mem_blk_tail);
+	if (blk_len < MIN_BLK_LEN) {
+		blk_len = MIN_BLK_LEN;
+	}
+
+	return blk_len;
+}
+
+/*
+ * Takes up to nr blocks of size from the pool under one hold of its lock,
+ * returns how many it took. size is not 0, nor large when the pool has a page
+ * allocator.
+ */
+static int alloc_mem_bulk(struct mem_pool *pool, size_t size, void **objs,
+			  int nr)
+{
+	size_t blk_len = get_blk_len(size);
+	struct mem_blk *p;
+	int i;
+
 	if (pool->lock_func != NULL) {
 		pool->lock_func(pool->lock);
 	}
-	p = get_mem_blk(pool, aligned_user_len);
-
-	if (p != NULL) {
+	for (i = 0; i < nr; i++) {
+		p = get_mem_blk(pool, blk_len);
+		if (p == NULL) {
+			break;
+		}
 		p->user_len = size;
 		pool->total_length += size;
+		objs[i] = get_user_start(p);
+	}
 #ifdef DEBUG_MEMORY_ALLOCATION
-		PRINT("total_length=%u\n", pool->total_length);
+	PRINT("total_length=%u\n", pool->total_length);
 #endif
-		if (pool->unlock_func != NULL) {
-			pool->unlock_func(pool->lock);
-		}
-		return p->user_start;
-	} else {
-		if (pool->unlock_func != NULL) {
-			pool->unlock_func(pool->lock);
-		}
-		return NULL;
+	if (pool->unlock_func != NULL) {
+		pool->unlock_func(pool->lock);
 	}
+
+	return i;
 }
 
-static void free_mem(struct mem_pool *pool, void *user_start)
+static void *alloc_mem(struct mem_pool *pool, size_t size)
 {
-	struct mem_blk *mem_blk;
+	size_t blk_len;
+	void *user_start;
 
 #ifdef DEBUG_MEMORY_ALLOCATION
-	PRINT("%s: user_start=%p\n", __FUNCTION__, user_start);
+	PRINT("%s: size=%u\n", __FUNCTION__, size);
 #endif
 
-	if (user_start == NULL) {
-		return;
+	if (size == 0) {
+		return NULL;
+	}
+
+	blk_len = get_blk_len(size);
+	if (blk_len >= LARGE_BLK_LEN && pool->page_alloc_func != NULL) {
+		return alloc_large_blk(pool, blk_len, size);
 	}
 
-	mem_blk = user_start - sizeof (struct mem_blk);
+	if (alloc_mem_bulk(pool, size, &user_start, 1) != 1) {
+		return NULL;
+	}
+
+	return user_start;
+}
+
+/* Gives nr blocks back to the pool under one hold of its lock. */
+static void free_mem_bulk(struct mem_pool *pool, void **objs, int nr)
+{
+	struct mem_blk *mem_blk;
+	int i;
 
 	if (pool->lock_func != NULL) {
 		pool->lock_func(pool->lock);
 	}
-	if (mem_blk_ok(mem_blk)) {
-		pool->total_length -= mem_blk->user_len;
+	for (i = 0; i < nr; i++) {
+		mem_blk = objs[i] - sizeof (struct mem_blk);
+		if (mem_blk_ok(mem_blk, MEM_BLK_IN_USE)) {
+			pool->total_length -= mem_blk->user_len;
+			free_mem_blk(pool, mem_blk);
+		} else {
+			PRINT("Invalid memory pointer to free: %p\n", objs[i]);
+		}
+	}
 #ifdef DEBUG_MEMORY_ALLOCATION
-		PRINT("total_length=%u\n", pool->total_length);
+	PRINT("total_length=%u\n", pool->total_length);
 #endif
-		free_mem_blk(pool, mem_blk);
-	} else {
-		PRINT("Invalid memory pointer to free: %p\n", user_start);
-	}
 	if (pool->unlock_func != NULL) {
 		pool->unlock_func(pool->lock);
 	}
 }
 
+/* Whether user_start is a large block, outside of the pool. */
+static int is_large_mem(const struct mem_pool *pool, const void *user_start)
+{
+	return (pool->page_free_func != NULL &&
+		(user_start < pool->start || user_start >= pool->end));
+}
+
+static void free_mem(struct mem_pool *pool, void *user_start)
+{
+	struct mem_blk *mem_blk;
+
+#ifdef DEBUG_MEMORY_ALLOCATION
+	PRINT("%s: user_start=%p\n", __FUNCTION__, user_start);
+#endif
+
+	if (user_start == NULL) {
+		return;
+	}
+
+	if (is_large_mem(pool, user_start)) {
+		mem_blk = user_start - sizeof (struct mem_blk);
+		if (mem_blk_ok(mem_blk, MEM_BLK_LARGE)) {
+			mem_blk->magic_num = 0;
+			pool->page_free_func(mem_blk, mem_blk->blk_len);
+		} else {
+			PRINT("Invalid memory pointer to free: %p\n", user_start);
+		}
+		return;
+	}
+
+	free_mem_bulk(pool, &user_start, 1);
+}
+
+/* Of the blocks in the pool, the large blocks are not counted. */
 static size_t get_pool_malloc_total_length(struct mem_pool *pool)
 {
 	struct mem_blk *p;
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <print_early.h>
+#include <mmu_context.h>
 #define printk print_early
 
 #include "page_table.c"
@@ -63,6 +64,9 @@ static uint64_t get_tcr(void)
 		TCR_IRGN_WBWA;
 	tcr |= TCR_T0SZ(va_bits);
 	tcr |= TCR_T1SZ(va_bits);
+	if (cpu_asid_bits() == 16) {
+		tcr |= TCR_ASID16;
+	}
 
 	return tcr;
 }
@@ -0,0 +1,686 @@
+#include <arch.h>
+#include <memory.h>
+#include <mm_types.h>
+#include <string.h>
+#include <printk.h>
+#include <spinlock.h>
+#include <stddef.h>
+#include <percpu.h>
+#include <smp.h>
+#include <sched.h>
+#include <preempt.h>
+
+/*
+ * Buddy allocator of the page pool, re. mm/page_alloc.c of Linux.
+ *
+ * A free block of 2^order pages is on free_area[order], its first page has
+ * PG_buddy and the order. The buddy of the block at pfn is at
+ * pfn ^ (1 << order): an allocation splits a larger block in halves down to
+ * the order, a free merges the block with its buddy as long as the buddy is
+ * free and whole. pfns count from PAGE_POOL_START.
+ *
+ * Single pages go through a list per cpu in front of the buddy lists, re.
+ * struct per_cpu_pages of Linux: it's taken with irqs disabled only, and
+ * refilled from or drained to the buddy lists batch pages at a time under
+ * zone_lock. Hot pages, freed recently and likely still in the cache, are
+ * added at the head of the list and reused first; cold ones at the tail.
+ */
+
+struct free_area {
+	struct list_head free_list;
+	unsigned long nr_free;
+};
+
+static struct spinlock zone_lock;
+static struct free_area free_area[MAX_ORDER];
+
+/* Kept at the start of the pool, it doesn't fit in the kernel bss. */
+struct page *mem_map;
+static unsigned long nr_reserved_pages;
+static unsigned long nr_free_pages;
+
+/* Refill below low, drain above high, batch pages at a time. */
+#ifndef PCP_BATCH
+#define PCP_BATCH 16
+#endif
+#define PCP_LOW (2 * PCP_BATCH)
+#define PCP_HIGH (6 * PCP_BATCH)
+
+struct per_cpu_pages {
+	struct list_head list;
+	unsigned int count;
+	unsigned int low;
+	unsigned int high;
+	unsigned int batch;
+	unsigned int nr_allocs;
+	unsigned int nr_frees;
+	unsigned int nr_cold_frees;
+	unsigned int nr_refills;
+	unsigned int nr_drains;
+};
+
+static DEFINE_PER_CPU(struct per_cpu_pages, pcp_lists);
+
+/* Zeroed single pages for get_zeroed_pages(0), filled by kzerod. */
+#define ZERO_POOL_HIGH 64
+#define ZERO_POOL_LOW 16
+#define KZEROD_RETRY_MS 100
+
+static struct spinlock zero_lock;
+static LIST_HEAD(zero_pool);
+static unsigned int nr_zeroed;
+static struct task_struct *kzerod_task;
+static unsigned int nr_zero_hits;
+static unsigned int nr_zero_misses;
+static unsigned int nr_zero_refills;
+static unsigned int nr_kzerod_wakeups;
+
+static void drain_zeroed_pages(void);
+
+/* In the linear bss, cleared at boot. */
+unsigned char empty_zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static unsigned long nr_allocs[MAX_ORDER];
+static unsigned long nr_alloc_fails[MAX_ORDER];
+static unsigned long nr_splits;
+static unsigned long nr_merges;
+
+static void set_page_order(struct page *page, unsigned int order)
+{
+	page->order = order;
+	page->flags |= PG_buddy;
+}
+
+static void rmv_page_order(struct page *page)
+{
+	page->order = 0;
+	page->flags &= ~PG_buddy;
+}
+
+/* zone_lock is held. */
+static void __free_one_page(struct page *page, unsigned int order)
+{
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long buddy_pfn;
+	struct page *buddy;
+
+	nr_free_pages += (1UL << order);
+	while (order < MAX_ORDER - 1) {
+		buddy_pfn = pfn ^ (1UL << order);
+		buddy = pfn_to_page(buddy_pfn);
+		if (!(buddy->flags & PG_buddy) || buddy->order != order) {
+			break;
+		}
+		list_del(&buddy->lru);
+		free_area[order].nr_free--;
+		rmv_page_order(buddy);
+		nr_merges++;
+		pfn &= buddy_pfn;
+		order++;
+	}
+
+	page = pfn_to_page(pfn);
+	set_page_order(page, order);
+	list_add(&page->lru, &free_area[order].free_list);
+	free_area[order].nr_free++;
+}
+
+/* Smallest free block of at least order, split down to order. */
+static struct page *__rmqueue(unsigned int order)
+{
+	unsigned int current_order;
+	struct free_area *area;
+	struct page *page;
+	struct page *buddy;
+
+	for (current_order = order; current_order < MAX_ORDER; current_order++) {
+		area = &free_area[current_order];
+		if (list_empty(&area->free_list)) {
+			continue;
+		}
+
+		page = list_first_entry(&area->free_list, struct page, lru);
+		list_del(&page->lru);
+		area->nr_free--;
+		rmv_page_order(page);
+
+		/* Give back the upper halves. */
+		while (current_order > order) {
+			current_order--;
+			buddy = page + (1UL << current_order);
+			set_page_order(buddy, current_order);
+			list_add(&buddy->lru, &free_area[current_order].free_list);
+			free_area[current_order].nr_free++;
+			nr_splits++;
+		}
+		nr_free_pages -= (1UL << order);
+
+		return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Called once before the first allocation: mem_map takes the first pages of
+ * the pool, the others are freed into the buddy lists.
+ */
+void init_page_alloc(void)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long pfn;
+	unsigned int order;
+	int cpu;
+
+	spin_lock_init(&zone_lock);
+	spin_lock_init(&zero_lock);
+	for (order = 0; order < MAX_ORDER; order++) {
+		INIT_LIST_HEAD(&free_area[order].free_list);
+		free_area[order].nr_free = 0;
+	}
+
+	mem_map = (struct page *)PAGE_POOL_START;
+	nr_reserved_pages = (MAX_NUM_PAGES * sizeof (struct page) + PAGE_SIZE - 1)
+		/ PAGE_SIZE;
+	memset(mem_map, 0, MAX_NUM_PAGES * sizeof (struct page));
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		pcp = &per_cpu(pcp_lists, cpu);
+		INIT_LIST_HEAD(&pcp->list);
+		pcp->count = 0;
+		pcp->low = PCP_LOW;
+		pcp->high = PCP_HIGH;
+		pcp->batch = PCP_BATCH;
+	}
+
+	for (pfn = 0; pfn < nr_reserved_pages; pfn++) {
+		pfn_to_page(pfn)->flags = PG_reserved;
+	}
+	for (pfn = nr_reserved_pages; pfn < MAX_NUM_PAGES; pfn++) {
+		__free_one_page(pfn_to_page(pfn), 0);
+	}
+	nr_merges = 0;
+}
+
+/* Moves up to count single pages to list, returns how many it moved. */
+static unsigned int rmqueue_bulk(unsigned int count, struct list_head *list)
+{
+	struct page *page;
+	unsigned int i;
+
+	spin_lock(&zone_lock);
+	for (i = 0; i < count; i++) {
+		page = __rmqueue(0);
+		if (page == NULL) {
+			break;
+		}
+		nr_allocs[0]++;
+		page->flags |= PG_pcp;
+		list_add_tail(&page->lru, list);
+	}
+	spin_unlock(&zone_lock);
+
+	return i;
+}
+
+/* Gives back the count coldest pages of pcp, irqs are disabled. */
+static void free_pages_bulk(struct per_cpu_pages *pcp, unsigned int count)
+{
+	struct page *page;
+
+	spin_lock(&zone_lock);
+	while (count > 0 && !list_empty(&pcp->list)) {
+		page = list_entry(pcp->list.prev, struct page, lru);
+		list_del(&page->lru);
+		pcp->count--;
+		page->flags &= ~PG_pcp;
+		__free_one_page(page, 0);
+		count--;
+	}
+	spin_unlock(&zone_lock);
+}
+
+static struct page *rmqueue_pcp(void)
+{
+	struct per_cpu_pages *pcp;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = &per_cpu(pcp_lists, get_cpu_core_id());
+	if (pcp->count <= pcp->low) {
+		pcp->count += rmqueue_bulk(pcp->batch, &pcp->list);
+		pcp->nr_refills++;
+	}
+	if (pcp->count > 0) {
+		page = list_first_entry(&pcp->list, struct page, lru);
+		list_del(&page->lru);
+		pcp->count--;
+		pcp->nr_allocs++;
+		page->flags &= ~PG_pcp;
+	}
+	local_irq_restore(flags);
+
+	return page;
+}
+
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = &per_cpu(pcp_lists, get_cpu_core_id());
+	page->flags |= PG_pcp;
+	if (cold) {
+		list_add_tail(&page->lru, &pcp->list);
+		pcp->nr_cold_frees++;
+	} else {
+		list_add(&page->lru, &pcp->list);
+	}
+	pcp->count++;
+	pcp->nr_frees++;
+	if (pcp->count >= pcp->high) {
+		free_pages_bulk(pcp, pcp->batch);
+		pcp->nr_drains++;
+	}
+	local_irq_restore(flags);
+}
+
+static void drain_local_pages(void *info)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = &per_cpu(pcp_lists, get_cpu_core_id());
+	free_pages_bulk(pcp, pcp->count);
+	local_irq_restore(flags);
+}
+
+/*
+ * The pages cached by the other cpus are drained only from a preemptible
+ * caller: one holding a spinlock, e.g. page_table_lock, may be waited for by
+ * a cpu that can't take the cross call meanwhile.
+ */
+static void drain_all_pages(void)
+{
+	drain_local_pages(NULL);
+	if (!irqs_disabled() && preempt_count() == 0) {
+		smp_call_function(drain_local_pages, NULL, true);
+	}
+}
+
+static struct page *buffered_rmqueue(unsigned int order)
+{
+	struct page *page;
+	unsigned long flags;
+
+	if (order == 0) {
+		return rmqueue_pcp();
+	}
+
+	flags = spin_lock_irqsave(&zone_lock);
+	page = __rmqueue(order);
+	if (page != NULL) {
+		nr_allocs[order]++;
+	}
+	spin_unlock_irqrestore(&zone_lock, flags);
+
+	return page;
+}
+
+void *get_free_pages(unsigned int order)
+{
+	struct page *page;
+	unsigned long flags;
+
+	if (order >= MAX_ORDER) {
+		printk("%s: order is too large, order=%u\n", __FUNCTION__, order);
+		return NULL;
+	}
+
+	page = buffered_rmqueue(order);
+	if (page == NULL) {
+		/*
+		 * The free pages may be split among the per-cpu lists, or
+		 * waiting zeroed in the pool of kzerod.
+		 */
+		drain_all_pages();
+		drain_zeroed_pages();
+		page = buffered_rmqueue(order);
+	}
+
+	if (page == NULL) {
+		flags = spin_lock_irqsave(&zone_lock);
+		nr_alloc_fails[order]++;
+		spin_unlock_irqrestore(&zone_lock, flags);
+		return NULL;
+	}
+	page->count = 1;
+
+	return page_address(page);
+}
+
+/* With 64-bit stores rather than the byte loop of memset(). */
+static void clear_pages(void *addr, unsigned int order)
+{
+	u64 *p = addr;
+	u64 *end = addr + (PAGE_SIZE << order);
+
+	while (p < end) {
+		p[0] = 0;
+		p[1] = 0;
+		p[2] = 0;
+		p[3] = 0;
+		p[4] = 0;
+		p[5] = 0;
+		p[6] = 0;
+		p[7] = 0;
+		p += 8;
+	}
+}
+
+static struct page *take_zeroed_page(void)
+{
+	struct task_struct *wake = NULL;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&zero_lock);
+	if (!list_empty(&zero_pool)) {
+		page = list_first_entry(&zero_pool, struct page, lru);
+		list_del(&page->lru);
+		page->flags &= ~PG_zeroed;
+		nr_zeroed--;
+		nr_zero_hits++;
+	} else {
+		nr_zero_misses++;
+	}
+	if (nr_zeroed < ZERO_POOL_LOW && kzerod_task != NULL &&
+	    kzerod_task->state == SLEEPING) {
+		wake = kzerod_task;
+		nr_kzerod_wakeups++;
+	}
+	spin_unlock_irqrestore(&zero_lock, flags);
+
+	/* kzerod sets itself SLEEPING with zero_lock held. */
+	if (wake != NULL) {
+		set_task_state(wake, RUNNING);
+	}
+
+	return page;
+}
+
+void *get_zeroed_pages(unsigned int order)
+{
+	struct page *page;
+	void *pages;
+
+	if (order == 0) {
+		page = take_zeroed_page();
+		if (page != NULL) {
+			page->count = 1;
+			return page_address(page);
+		}
+	} else {
+		__atomic_add_fetch(&nr_zero_misses, 1, __ATOMIC_RELAXED);
+	}
+
+	pages = get_free_pages(order);
+
+	if (pages != NULL) {
+		clear_pages(pages, order);
+	}
+
+	return pages;
+}
+
+/* Gives the zeroed pages back to the buddy lists, memory is short. */
+static void drain_zeroed_pages(void)
+{
+	LIST_HEAD(pages);
+	struct page *page;
+	struct page *n;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&zero_lock);
+	while (!list_empty(&zero_pool)) {
+		list_move_tail(zero_pool.next, &pages);
+	}
+	nr_zeroed = 0;
+	spin_unlock_irqrestore(&zero_lock, flags);
+
+	flags = spin_lock_irqsave(&zone_lock);
+	list_for_each_entry_safe(page, n, &pages, lru) {
+		list_del(&page->lru);
+		page->flags &= ~PG_zeroed;
+		__free_one_page(page, 0);
+	}
+	spin_unlock_irqrestore(&zone_lock, flags);
+}
+
+/*
+ * Refills the pool of zeroed pages to ZERO_POOL_HIGH once it fell below
+ * ZERO_POOL_LOW. There are no idle priorities: it only zeroes a page when no
+ * other task is runnable on its cpu.
+ */
+static int kzerod(void *arg)
+{
+	struct task_struct *current = get_current_proc();
+	struct page *page;
+	unsigned long flags;
+	void *addr;
+
+	flags = spin_lock_irqsave(&zero_lock);
+	kzerod_task = current;
+	spin_unlock_irqrestore(&zero_lock, flags);
+
+	while (true) {
+		flags = spin_lock_irqsave(&zero_lock);
+		if (nr_zeroed >= ZERO_POOL_HIGH) {
+			set_task_state(current, SLEEPING);
+			spin_unlock_irqrestore(&zero_lock, flags);
+			schedule();
+			continue;
+		}
+		spin_unlock_irqrestore(&zero_lock, flags);
+
+		if (nr_running_cpu(get_cpu_core_id()) > 1) {
+			set_task_state(current, SLEEPING);
+			schedule_timeout(1);
+			continue;
+		}
+
+		addr = get_free_pages(0);
+		if (addr == NULL) {
+			msleep(KZEROD_RETRY_MS);
+			continue;
+		}
+		clear_pages(addr, 0);
+
+		page = virt_to_page(addr);
+		flags = spin_lock_irqsave(&zero_lock);
+		page->flags |= PG_zeroed;
+		list_add(&page->lru, &zero_pool);
+		nr_zeroed++;
+		nr_zero_refills++;
+		spin_unlock_irqrestore(&zero_lock, flags);
+	}
+
+	return 0;
+}
+
+int create_kzerod(void)
+{
+	if (kernel_thread("kzerod", kzerod, NULL) < 0) {
+		printk("%s: kernel_thread failed\n", __FUNCTION__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void __free_pages(void *addr, unsigned int order, int cold)
+{
+	unsigned long pfn;
+	struct page *page;
+	unsigned long flags;
+
+	if ((unsigned long)addr < PAGE_POOL_START
+			|| (unsigned long)addr >= PAGE_POOL_END) {
+		printk("Error in %s: addr=%p\n", __FUNCTION__, addr);
+		return;
+	}
+
+	if (((unsigned long)addr & (PAGE_SIZE - 1)) != 0) {
+		printk("Error in %s: addr=%p is not page-aligned.\n",
+		       __FUNCTION__, addr);
+		return;
+	}
+
+	pfn = ((unsigned long)addr - PAGE_POOL_START) / PAGE_SIZE;
+	if (order >= MAX_ORDER || (pfn & ((1UL << order) - 1)) != 0) {
+		printk("Error in %s: addr=%p is not a block of order %u\n",
+		       __FUNCTION__, addr, order);
+		return;
+	}
+
+	page = pfn_to_page(pfn);
+	if (page->flags & (PG_buddy | PG_pcp | PG_zeroed | PG_reserved)) {
+		printk("Error in %s: addr=%p, order=%u, flags=%x\n",
+		       __FUNCTION__, addr, order, page->flags);
+		assert(0);
+	}
+
+	if (order == 0) {
+		free_hot_cold_page(page, cold);
+		return;
+	}
+
+	flags = spin_lock_irqsave(&zone_lock);
+	__free_one_page(page, order);
+	spin_unlock_irqrestore(&zone_lock, flags);
+}
+
+void free_pages(void *addr, unsigned int order)
+{
+	__free_pages(addr, order, false);
+}
+
+void free_cold_page(void *addr)
+{
+	__free_pages(addr, 0, true);
+}
+
+void get_page(void *addr)
+{
+	if (!page_in_pool(addr)) {
+		return;
+	}
+
+	__atomic_add_fetch(&virt_to_page(addr)->count, 1, __ATOMIC_RELAXED);
+}
+
+void put_page(void *addr)
+{
+	int count;
+
+	if (!page_in_pool(addr)) {
+		return;
+	}
+
+	count = __atomic_sub_fetch(&virt_to_page(addr)->count, 1, __ATOMIC_ACQ_REL);
+	assert(count >= 0);
+	if (count == 0) {
+		__free_pages(addr, 0, false);
+	}
+}
+
+int page_count(void *addr)
+{
+	if (!page_in_pool(addr)) {
+		return 0;
+	}
+
+	return __atomic_load_n(&virt_to_page(addr)->count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * How much a failure to allocate a block of order would be due to
+ * fragmentation rather than to a lack of memory, re. mm/vmstat.c of Linux:
+ * 0 to 1000, towards 1000 the free memory is split in small blocks. -1000
+ * when a large enough block is free.
+ */
+static int __fragmentation_index(unsigned int order)
+{
+	unsigned long requested = 1UL << order;
+	unsigned long free_blocks_total = 0;
+	unsigned long free_blocks_suitable = 0;
+	unsigned long free_pages = 0;
+	unsigned int o;
+
+	for (o = 0; o < MAX_ORDER; o++) {
+		free_blocks_total += free_area[o].nr_free;
+		free_pages += free_area[o].nr_free << o;
+		if (o >= order) {
+			free_blocks_suitable += free_area[o].nr_free;
+		}
+	}
+
+	if (free_blocks_total == 0) {
+		return 0;
+	}
+	if (free_blocks_suitable != 0) {
+		return -1000;
+	}
+
+	return 1000 - (1000 + free_pages * 1000 / requested) / free_blocks_total;
+}
+
+int fragmentation_index(unsigned int order)
+{
+	unsigned long flags;
+	int index;
+
+	if (order >= MAX_ORDER) {
+		printk("%s: order is too large, order=%u\n", __FUNCTION__, order);
+		return 0;
+	}
+
+	flags = spin_lock_irqsave(&zone_lock);
+	index = __fragmentation_index(order);
+	spin_unlock_irqrestore(&zone_lock, flags);
+
+	return index;
+}
+
+void dump_buddy_stats(void)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+	unsigned int order;
+	int cpu;
+
+	flags = spin_lock_irqsave(&zone_lock);
+	printk("buddy: free pages=%d, reserved=%d, splits=%d, merges=%d\n",
+	       (u32)nr_free_pages, (u32)nr_reserved_pages, (u32)nr_splits,
+	       (u32)nr_merges);
+	for (order = 0; order < MAX_ORDER; order++) {
+		printk("order%d: free blocks=%d, allocs=%d, fails=%d, frag_index=%d\n",
+		       order, (u32)free_area[order].nr_free,
+		       (u32)nr_allocs[order], (u32)nr_alloc_fails[order],
+		       __fragmentation_index(order));
+	}
+	spin_unlock_irqrestore(&zone_lock, flags);
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		pcp = &per_cpu(pcp_lists, cpu);
+		printk("cpu%d: pcp pages=%d, allocs=%d, frees=%d, cold frees=%d, refills=%d, drains=%d\n",
+		       cpu, pcp->count, pcp->nr_allocs, pcp->nr_frees,
+		       pcp->nr_cold_frees, pcp->nr_refills, pcp->nr_drains);
+	}
+	printk("zeroed pages=%d, hits=%d, misses=%d, zeroed by kzerod=%d, kzerod wakeups=%d\n",
+	       nr_zeroed, nr_zero_hits, nr_zero_misses, nr_zero_refills,
+	       nr_kzerod_wakeups);
+}
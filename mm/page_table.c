@@ -15,10 +15,24 @@ static uint64_t get_phy_addr(uint64_t descriptor)
 	return (descriptor & ~(PAGE_SIZE - 1) & ((1ULL << 48) - 1));
 }
 
-static void setup_pg_for_addr(uint64_t *pg_dir, uint64_t phy_addr,
-			      uint64_t virt_addr, uint64_t attrs,
-			      void *(*pg_calloc_func)(unsigned int order),
-			      int mmu_on)
+/* Level 2 blocks, used wherever a mapping is aligned to them. */
+#define SECTION_SHIFT 21
+#define SECTION_SIZE (1UL << SECTION_SHIFT)
+
+/* Whether entry, of a table at layer, maps a block rather than a table. */
+static int is_block(uint64_t entry, int layer)
+{
+	return (layer != 12 && (entry & PTE_TYPE_MASK) == PTE_TYPE_BLOCK);
+}
+
+/*
+ * Maps the page at virt_addr, or the block of leaf_layer. Returns -1 if a
+ * block can't be used: part of it is mapped by a table already.
+ */
+static int setup_pg_for_addr(uint64_t *pg_dir, uint64_t phy_addr,
+			     uint64_t virt_addr, uint64_t attrs, int leaf_layer,
+			     void *(*pg_calloc_func)(unsigned int order),
+			     int mmu_on)
 {
 	int i;
 	int pg_entry_index;
@@ -36,26 +50,38 @@ static void setup_pg_for_addr(uint64_t *pg_dir, uint64_t phy_addr,
 		       next_layer_pt[pg_entry_index]);
 		printk("next_layer_pt[0]=%p\n", next_layer_pt[0]);
 #endif
-		if (next_layer_pt[pg_entry_index] == 0) {
-			if (layers[i] != 12) {
-				new_pt = (uint64_t)pg_calloc_func(0);
-				if (new_pt == 0) {
-					assert(0);
-				}
-				if (!is_pointer_aligned(new_pt, ~0xFFF)) {
-					printk("new_pt=%p is not aligned\n",
-					       new_pt);
-					assert(0);
-				}
-				if (mmu_on) {
-					new_pt = (uint64_t)__pa(new_pt);
-				}
-				next_layer_pt[pg_entry_index] = new_pt |
-					attrs | PTE_TYPE_TABLE | PTE_BLOCK_AF;
-			} else {
+		if (layers[i] == leaf_layer) {
+			if (next_layer_pt[pg_entry_index] == 0) {
 				next_layer_pt[pg_entry_index] = phy_addr |
-					attrs | PTE_TYPE_TABLE | PTE_BLOCK_AF;
+					attrs | PTE_BLOCK_AF |
+					(leaf_layer == 12 ? PTE_TYPE_TABLE :
+					 PTE_TYPE_BLOCK);
+			} else if (leaf_layer != 12 &&
+				   !is_block(next_layer_pt[pg_entry_index],
+					     layers[i])) {
+				return -1;
+			}
+			return 0;
+		}
+
+		if (next_layer_pt[pg_entry_index] == 0) {
+			new_pt = (uint64_t)pg_calloc_func(0);
+			if (new_pt == 0) {
+				assert(0);
+			}
+			if (!is_pointer_aligned(new_pt, ~0xFFF)) {
+				printk("new_pt=%p is not aligned\n",
+				       new_pt);
+				assert(0);
 			}
+			if (mmu_on) {
+				new_pt = (uint64_t)__pa(new_pt);
+			}
+			next_layer_pt[pg_entry_index] = new_pt |
+				attrs | PTE_TYPE_TABLE | PTE_BLOCK_AF;
+		} else if (is_block(next_layer_pt[pg_entry_index], layers[i])) {
+			/* Mapped by a block already. */
+			return 0;
 		}
 
 		next_layer_pt = (uint64_t *)
@@ -64,6 +90,41 @@ static void setup_pg_for_addr(uint64_t *pg_dir, uint64_t phy_addr,
 			next_layer_pt = __va(next_layer_pt);
 		}
 	}
+
+	return 0;
+}
+
+/*
+ * Replaces the block entry of a table at layer by a table of the same
+ * mappings one layer down, e.g. to unmap a page of it. Break before make:
+ * the entry is invalid until the TLB entries of the block are gone.
+ */
+static void split_block(uint64_t *entry, int layer, int asid,
+			void *virt_addr,
+			void *(*pg_calloc_func)(unsigned int order))
+{
+	uint64_t *new_pt;
+	uint64_t phy_addr;
+	uint64_t attrs;
+	uint64_t type;
+	int i;
+
+	new_pt = pg_calloc_func(0);
+	if (new_pt == NULL) {
+		assert(0);
+	}
+
+	phy_addr = get_phy_addr(*entry);
+	attrs = *entry & ~get_phy_addr(~0ULL) & ~PTE_TYPE_MASK;
+	type = (layer - 9 == 12) ? PTE_TYPE_TABLE : PTE_TYPE_BLOCK;
+	for (i = 0; i < PAGE_SIZE / sizeof (uint64_t); i++) {
+		new_pt[i] = (phy_addr + ((uint64_t)i << (layer - 9))) |
+			attrs | type;
+	}
+
+	*entry = 0;
+	invalidate_tlb_by_va(asid, virt_addr);
+	*entry = (uint64_t)__pa(new_pt) | attrs | PTE_TYPE_TABLE;
 }
 
 /*
@@ -90,6 +151,11 @@ static void *walk_virt_addr(uint64_t *pg_dir, void *virt_addr, int mmu_on)
 #if defined DEBUG_PAGE_TABLE || defined SETUP_USER_PAGE_MAPPING
 		printk("entry=%p\n", next_layer_pt[pg_entry_index]);
 #endif
+		if (is_block(next_layer_pt[pg_entry_index], layers[i])) {
+			return (void *)(get_phy_addr(next_layer_pt[pg_entry_index])
+					+ PAGE_ADDR((uint64_t)virt_addr &
+						    ((1UL << layers[i]) - 1)));
+		}
 		next_layer_pt = (uint64_t *)
 			get_phy_addr(next_layer_pt[pg_entry_index]);
 		if (mmu_on) {
@@ -106,8 +172,10 @@ static void *walk_virt_addr(uint64_t *pg_dir, void *virt_addr, int mmu_on)
 	return next_layer_pt;
 }
 
+/* A block mapping virt_addr is split first. */
 static int unmap_one_user_page(int asid, uint64_t *pg_dir, void *virt_addr,
-			void (*free_pages)(void *addr, unsigned int order))
+			void (*free_pages)(void *addr, unsigned int order),
+			void *(*pg_calloc_func)(unsigned int order))
 {
 	int i;
 	int pg_entry_index;
@@ -125,6 +193,14 @@ static int unmap_one_user_page(int asid, uint64_t *pg_dir, void *virt_addr,
 		printk("pg_entry_index=%d\n", pg_entry_index);
 		printk("entry=%p\n", next_layer_pt[pg_entry_index]);
 #endif
+		if (next_layer_pt[pg_entry_index] == 0) {
+			printk("user page table entry to free is NULL\n");
+			return 0;
+		}
+		if (is_block(next_layer_pt[pg_entry_index], layers[i])) {
+			split_block(&next_layer_pt[pg_entry_index], layers[i],
+				    asid, virt_addr, pg_calloc_func);
+		}
 		next_layer_pt = (uint64_t *)
 			get_phy_addr(next_layer_pt[pg_entry_index]);
 		next_layer_pt = __va(next_layer_pt);
@@ -149,6 +225,10 @@ static int unmap_one_user_page(int asid, uint64_t *pg_dir, void *virt_addr,
 }
 
 #ifndef MMU_BY_BLOCK
+/*
+ * Maps m with level 2 blocks where both addresses are aligned to them, with
+ * pages elsewhere.
+ */
 static void add_single_map(const struct memory_map *m, uint64_t *pg_dir_start,
 			   void *(*pg_calloc_func)(unsigned int order),
 			   int mmu_on)
@@ -156,13 +236,24 @@ static void add_single_map(const struct memory_map *m, uint64_t *pg_dir_start,
 	uint64_t phy_addr;
 	uint64_t virt_addr;
 	uint64_t end_addr;
+	uint64_t size;
 
 	end_addr = m->phy_addr + m->size;
 	for (phy_addr = m->phy_addr, virt_addr = m->virt_addr;
 	     phy_addr < end_addr;
-	     phy_addr += PAGE_SIZE, virt_addr += PAGE_SIZE) {
+	     phy_addr += size, virt_addr += size) {
+		size = SECTION_SIZE;
+		if (((phy_addr | virt_addr) & (SECTION_SIZE - 1)) == 0 &&
+		    end_addr - phy_addr >= SECTION_SIZE &&
+		    setup_pg_for_addr(pg_dir_start, phy_addr, virt_addr,
+				      m->attrs, SECTION_SHIFT, pg_calloc_func,
+				      mmu_on) == 0) {
+			continue;
+		}
+
+		size = PAGE_SIZE;
 		setup_pg_for_addr(pg_dir_start, phy_addr, virt_addr, m->attrs,
-				  pg_calloc_func, mmu_on);
+				  12, pg_calloc_func, mmu_on);
 	}
 }
 #endif
@@ -0,0 +1,505 @@
+#include <arch.h>
+#include <memory.h>
+#include <string.h>
+#include <printk.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <stddef.h>
+#include <list.h>
+#include <slab.h>
+
+/*
+ * A slab is a block of 2^order pages from the buddy allocator: struct slab,
+ * then a stack of the indexes of its free objects, then the objects. Blocks
+ * are aligned to their size, so the slab of an object is found by masking
+ * its address.
+ *
+ * Each cpu takes objects from its own magazine with irqs disabled. An empty
+ * magazine is refilled with SLAB_MAG_BATCH objects from the slabs, and a full
+ * one gives its oldest SLAB_MAG_BATCH objects back, under the cache lock.
+ */
+
+#ifndef SLAB_MAG_SIZE
+#define SLAB_MAG_SIZE 16
+#endif
+#define SLAB_MAG_BATCH (SLAB_MAG_SIZE / 2)
+
+#define SLAB_MAX_ORDER 3
+#define SLAB_MIN_OBJS 8		/* Per slab, unless SLAB_MAX_ORDER is reached. */
+#define SLAB_MIN_ALIGN 8
+#define L1_CACHE_BYTES 64
+#define CACHE_NAME_LEN 16
+
+#define SLAB_ALIGN(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct array_cache {
+	unsigned int avail;
+	unsigned int nr_allocs;
+	unsigned int nr_frees;
+	unsigned int nr_refills;
+	unsigned int nr_flushes;
+	void *entry[SLAB_MAG_SIZE];
+};
+
+struct slab {
+	struct list_head list;
+	unsigned int inuse;
+	unsigned int free_top;
+	unsigned short free[];	/* free[0..free_top) index the free objects. */
+};
+
+struct kmem_cache {
+	struct array_cache array[NUM_CPUS];
+	struct spinlock lock;
+	struct list_head slabs_full;
+	struct list_head slabs_partial;
+	struct list_head slabs_free;
+	size_t size;		/* Of an object, aligned. */
+	size_t obj_offset;	/* Of the first object in the slab. */
+	unsigned int num;	/* Objects per slab. */
+	unsigned int order;
+	unsigned int flags;
+	void (*ctor)(void *obj);
+	char name[CACHE_NAME_LEN];
+	struct list_head next;	/* In cache_chain. */
+	unsigned int nr_slabs;
+	unsigned int nr_active_objs;
+	unsigned int nr_grows;
+	unsigned int nr_reaped;
+};
+
+/* The cache of the kmem_cache structures. */
+static struct kmem_cache cache_cache;
+
+static LIST_HEAD(cache_chain);
+static struct spinlock cache_chain_lock;
+
+static struct slab *virt_to_slab(const struct kmem_cache *cachep,
+				 const void *obj)
+{
+	unsigned long offset = (unsigned long)obj - PAGE_POOL_START;
+
+	return (struct slab *)(PAGE_POOL_START +
+			       (offset & ~((PAGE_SIZE << cachep->order) - 1)));
+}
+
+static void *index_to_obj(const struct kmem_cache *cachep,
+			  const struct slab *slab, unsigned int idx)
+{
+	return (void *)slab + cachep->obj_offset + idx * cachep->size;
+}
+
+/* Objects that fit in a slab of order, and where the first one starts. */
+static unsigned int cache_estimate(unsigned int order, size_t size,
+				   size_t align, size_t *obj_offset)
+{
+	size_t bytes = PAGE_SIZE << order;
+	unsigned int num;
+	size_t mgmt = 0;
+
+	num = (bytes - sizeof (struct slab)) / (size + sizeof (unsigned short));
+	while (num > 0) {
+		mgmt = SLAB_ALIGN(sizeof (struct slab) +
+				  num * sizeof (unsigned short), align);
+		if (mgmt + num * size <= bytes) {
+			break;
+		}
+		num--;
+	}
+	*obj_offset = mgmt;
+
+	return num;
+}
+
+static int cache_setup(struct kmem_cache *cachep, const char *name,
+		       size_t size, size_t align, unsigned int flags,
+		       void (*ctor)(void *obj))
+{
+	unsigned int order;
+	unsigned int num = 0;
+	size_t obj_offset = 0;
+	int cpu;
+
+	if (align < SLAB_MIN_ALIGN) {
+		align = SLAB_MIN_ALIGN;
+	}
+	if ((flags & SLAB_HWCACHE_ALIGN) && align < L1_CACHE_BYTES) {
+		align = L1_CACHE_BYTES;
+	}
+	size = SLAB_ALIGN(size, align);
+
+	for (order = 0; order <= SLAB_MAX_ORDER; order++) {
+		num = cache_estimate(order, size, align, &obj_offset);
+		if (num >= SLAB_MIN_OBJS || order == SLAB_MAX_ORDER) {
+			break;
+		}
+	}
+	if (num == 0) {
+		printk("%s: objects of %s are too large, size=%u\n",
+		       __FUNCTION__, name, (u32)size);
+		return -1;
+	}
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		memset(&cachep->array[cpu], 0, sizeof (cachep->array[cpu]));
+	}
+	spin_lock_init(&cachep->lock);
+	INIT_LIST_HEAD(&cachep->slabs_full);
+	INIT_LIST_HEAD(&cachep->slabs_partial);
+	INIT_LIST_HEAD(&cachep->slabs_free);
+	cachep->size = size;
+	cachep->obj_offset = obj_offset;
+	cachep->num = num;
+	cachep->order = order;
+	cachep->flags = flags;
+	cachep->ctor = ctor;
+	strncpy(cachep->name, name, CACHE_NAME_LEN - 1);
+	cachep->name[CACHE_NAME_LEN - 1] = '\0';
+	cachep->nr_slabs = 0;
+	cachep->nr_active_objs = 0;
+	cachep->nr_grows = 0;
+	cachep->nr_reaped = 0;
+
+	return 0;
+}
+
+void kmem_cache_init(void)
+{
+	spin_lock_init(&cache_chain_lock);
+	cache_setup(&cache_cache, "kmem_cache", sizeof (struct kmem_cache), 0,
+		    SLAB_HWCACHE_ALIGN, NULL);
+	list_add(&cache_cache.next, &cache_chain);
+}
+
+/* cachep->lock is held. */
+static struct slab *cache_grow(struct kmem_cache *cachep)
+{
+	struct slab *slab;
+	unsigned int i;
+
+	slab = get_free_pages(cachep->order);
+	if (slab == NULL) {
+		return NULL;
+	}
+
+	slab->inuse = 0;
+	slab->free_top = cachep->num;
+	for (i = 0; i < cachep->num; i++) {
+		/* Hands out the objects in address order. */
+		slab->free[i] = cachep->num - 1 - i;
+		if (cachep->ctor != NULL) {
+			cachep->ctor(index_to_obj(cachep, slab, i));
+		}
+	}
+	list_add(&slab->list, &cachep->slabs_free);
+	cachep->nr_slabs++;
+	cachep->nr_grows++;
+
+	return slab;
+}
+
+/* Moves slab to the list of its fill state, cachep->lock is held. */
+static void slab_fix_list(struct kmem_cache *cachep, struct slab *slab)
+{
+	list_del(&slab->list);
+	if (slab->inuse == 0) {
+		list_add(&slab->list, &cachep->slabs_free);
+	} else if (slab->inuse == cachep->num) {
+		list_add(&slab->list, &cachep->slabs_full);
+	} else {
+		list_add(&slab->list, &cachep->slabs_partial);
+	}
+}
+
+/* Frees the empty slabs but keep, cachep->lock is held. */
+static unsigned int __cache_reap(struct kmem_cache *cachep, unsigned int keep)
+{
+	struct slab *slab;
+	struct slab *n;
+	unsigned int nr_pages = 0;
+
+	list_for_each_entry_safe(slab, n, &cachep->slabs_free, list) {
+		if (keep > 0) {
+			keep--;
+			continue;
+		}
+		list_del(&slab->list);
+		free_pages(slab, cachep->order);
+		cachep->nr_slabs--;
+		cachep->nr_reaped++;
+		nr_pages += (1 << cachep->order);
+	}
+
+	return nr_pages;
+}
+
+/* Irqs are disabled. */
+static void cache_alloc_refill(struct kmem_cache *cachep,
+			       struct array_cache *ac)
+{
+	struct slab *slab;
+
+	spin_lock(&cachep->lock);
+	while (ac->avail < SLAB_MAG_BATCH) {
+		if (!list_empty(&cachep->slabs_partial)) {
+			slab = list_first_entry(&cachep->slabs_partial,
+						struct slab, list);
+		} else if (!list_empty(&cachep->slabs_free)) {
+			slab = list_first_entry(&cachep->slabs_free,
+						struct slab, list);
+		} else {
+			slab = cache_grow(cachep);
+			if (slab == NULL) {
+				break;
+			}
+		}
+
+		while (slab->free_top > 0 && ac->avail < SLAB_MAG_BATCH) {
+			slab->free_top--;
+			ac->entry[ac->avail++] =
+				index_to_obj(cachep, slab,
+					     slab->free[slab->free_top]);
+			slab->inuse++;
+			cachep->nr_active_objs++;
+		}
+		slab_fix_list(cachep, slab);
+	}
+	spin_unlock(&cachep->lock);
+	ac->nr_refills++;
+}
+
+/* Gives nr objects back to their slabs, cachep->lock is held. */
+static void free_block(struct kmem_cache *cachep, void **objs,
+		       unsigned int nr)
+{
+	struct slab *slab;
+	unsigned int idx;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		slab = virt_to_slab(cachep, objs[i]);
+		idx = (objs[i] - (void *)slab - cachep->obj_offset)
+			/ cachep->size;
+		slab->free[slab->free_top++] = idx;
+		slab->inuse--;
+		cachep->nr_active_objs--;
+		slab_fix_list(cachep, slab);
+	}
+
+	/* One empty slab is kept to absorb alloc/free cycles. */
+	if (!(cachep->flags & SLAB_TYPESAFE)) {
+		__cache_reap(cachep, 1);
+	}
+}
+
+/* Irqs are disabled. */
+static void cache_flusharray(struct kmem_cache *cachep,
+			     struct array_cache *ac, unsigned int nr)
+{
+	spin_lock(&cachep->lock);
+	free_block(cachep, ac->entry, nr);
+	spin_unlock(&cachep->lock);
+
+	ac->avail -= nr;
+	memcpy(&ac->entry[0], &ac->entry[nr], ac->avail * sizeof (void *));
+	ac->nr_flushes++;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cachep)
+{
+	struct array_cache *ac;
+	void *obj = NULL;
+	unsigned long flags;
+
+	if (cachep == NULL) {
+		printk("%s: cachep is null\n", __FUNCTION__);
+		return NULL;
+	}
+
+	local_irq_save(flags);
+	ac = &cachep->array[get_cpu_core_id()];
+	if (ac->avail == 0) {
+		cache_alloc_refill(cachep, ac);
+	}
+	if (ac->avail > 0) {
+		obj = ac->entry[--ac->avail];
+		ac->nr_allocs++;
+	}
+	local_irq_restore(flags);
+
+	return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cachep)
+{
+	void *obj;
+
+	obj = kmem_cache_alloc(cachep);
+	if (obj != NULL) {
+		memset(obj, 0, cachep->size);
+	}
+
+	return obj;
+}
+
+static int obj_is_valid(const struct kmem_cache *cachep, const void *obj)
+{
+	const struct slab *slab;
+	unsigned long offset;
+
+	if ((unsigned long)obj < PAGE_POOL_START
+			|| (unsigned long)obj >= PAGE_POOL_END) {
+		return false;
+	}
+
+	slab = virt_to_slab(cachep, obj);
+	offset = (unsigned long)(obj - (void *)slab);
+	if (offset < cachep->obj_offset) {
+		return false;
+	}
+	offset -= cachep->obj_offset;
+
+	return (offset % cachep->size == 0) &&
+		(offset / cachep->size < cachep->num);
+}
+
+void kmem_cache_free(struct kmem_cache *cachep, void *obj)
+{
+	struct array_cache *ac;
+	unsigned long flags;
+
+	if (cachep == NULL || obj == NULL) {
+		printk("%s: cachep or obj is null\n", __FUNCTION__);
+		return;
+	}
+	if (!obj_is_valid(cachep, obj)) {
+		printk("Error in %s: obj=%p is not from %s\n",
+		       __FUNCTION__, obj, cachep->name);
+		return;
+	}
+
+	local_irq_save(flags);
+	ac = &cachep->array[get_cpu_core_id()];
+	if (ac->avail == SLAB_MAG_SIZE) {
+		cache_flusharray(cachep, ac, SLAB_MAG_BATCH);
+	}
+	ac->entry[ac->avail++] = obj;
+	ac->nr_frees++;
+	local_irq_restore(flags);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned int flags,
+				     void (*ctor)(void *obj))
+{
+	struct kmem_cache *cachep;
+	unsigned long irq_flags;
+
+	if (name == NULL || size == 0) {
+		printk("%s: name is null or size is 0\n", __FUNCTION__);
+		return NULL;
+	}
+	if ((align & (align - 1)) != 0) {
+		printk("%s: align is not a power of 2, align=%u\n",
+		       __FUNCTION__, (u32)align);
+		return NULL;
+	}
+
+	cachep = kmem_cache_alloc(&cache_cache);
+	if (cachep == NULL) {
+		return NULL;
+	}
+	if (cache_setup(cachep, name, size, align, flags, ctor) < 0) {
+		kmem_cache_free(&cache_cache, cachep);
+		return NULL;
+	}
+
+	irq_flags = spin_lock_irqsave(&cache_chain_lock);
+	list_add_tail(&cachep->next, &cache_chain);
+	spin_unlock_irqrestore(&cache_chain_lock, irq_flags);
+
+	return cachep;
+}
+
+int kmem_cache_shrink(struct kmem_cache *cachep)
+{
+	struct array_cache *ac;
+	unsigned long flags;
+	int nr_pages;
+
+	if (cachep == NULL) {
+		printk("%s: cachep is null\n", __FUNCTION__);
+		return -1;
+	}
+
+	/* Only the magazine of this cpu is flushed. */
+	local_irq_save(flags);
+	ac = &cachep->array[get_cpu_core_id()];
+	if (ac->avail > 0) {
+		cache_flusharray(cachep, ac, ac->avail);
+	}
+	spin_lock(&cachep->lock);
+	nr_pages = (cachep->flags & SLAB_TYPESAFE) ? 0 : __cache_reap(cachep, 0);
+	spin_unlock(&cachep->lock);
+	local_irq_restore(flags);
+
+	return nr_pages;
+}
+
+int kmem_cache_destroy(struct kmem_cache *cachep)
+{
+	struct array_cache *ac;
+	unsigned long flags;
+	int cpu;
+
+	if (cachep == NULL || cachep == &cache_cache) {
+		printk("%s: cachep is null or cache_cache\n", __FUNCTION__);
+		return -1;
+	}
+
+	flags = spin_lock_irqsave(&cachep->lock);
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		ac = &cachep->array[cpu];
+		free_block(cachep, ac->entry, ac->avail);
+		ac->avail = 0;
+	}
+	if (!list_empty(&cachep->slabs_full)
+			|| !list_empty(&cachep->slabs_partial)) {
+		spin_unlock_irqrestore(&cachep->lock, flags);
+		printk("%s: %s has objects in use\n", __FUNCTION__, cachep->name);
+		return -1;
+	}
+	__cache_reap(cachep, 0);
+	spin_unlock_irqrestore(&cachep->lock, flags);
+
+	flags = spin_lock_irqsave(&cache_chain_lock);
+	list_del(&cachep->next);
+	spin_unlock_irqrestore(&cache_chain_lock, flags);
+
+	kmem_cache_free(&cache_cache, cachep);
+
+	return 0;
+}
+
+void dump_slab_stats(void)
+{
+	struct kmem_cache *cachep;
+	struct array_cache *ac;
+	unsigned long flags;
+	int cpu;
+
+	flags = spin_lock_irqsave(&cache_chain_lock);
+	list_for_each_entry(cachep, &cache_chain, next) {
+		printk("%s: objsize=%d, objs/slab=%d, order=%d, slabs=%d, active objs=%d, grows=%d, reaped=%d\n",
+		       cachep->name, (u32)cachep->size, cachep->num,
+		       cachep->order, cachep->nr_slabs, cachep->nr_active_objs,
+		       cachep->nr_grows, cachep->nr_reaped);
+		for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+			ac = &cachep->array[cpu];
+			printk("  cpu%d: magazine=%d, allocs=%d, frees=%d, refills=%d, flushes=%d\n",
+			       cpu, ac->avail, ac->nr_allocs, ac->nr_frees,
+			       ac->nr_refills, ac->nr_flushes);
+		}
+	}
+	spin_unlock_irqrestore(&cache_chain_lock, flags);
+}
@@ -0,0 +1,181 @@
+#include "RbtreeTest.h"
+#include "../include/rbtree.h"
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION( RbtreeTest );
+
+struct item {
+    struct rb_node node;
+    int key;
+};
+
+enum { NUM_ITEMS = 100 };
+
+static struct rb_root root;
+static struct item items[NUM_ITEMS];
+
+static void
+insert(struct item *new_item)
+{
+    struct rb_node **link = &root.rb_node;
+    struct rb_node *parent = NULL;
+
+    while (*link != NULL) {
+        parent = *link;
+        if (new_item->key < rb_entry(parent, struct item, node)->key) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+        }
+    }
+
+    rb_link_node(&new_item->node, parent, link);
+    rb_insert_color(&new_item->node, &root);
+}
+
+// Returns the black height, or -1 if a red-black rule is broken.
+static int
+black_height(const struct rb_node *n, const struct rb_node *parent)
+{
+    int left;
+    int right;
+
+    if (n == NULL) {
+        return 1;
+    }
+    if (n->rb_parent != parent) {
+        return -1;
+    }
+    if (n->rb_color == RB_RED &&
+        ((n->rb_left != NULL && n->rb_left->rb_color == RB_RED) ||
+         (n->rb_right != NULL && n->rb_right->rb_color == RB_RED))) {
+        return -1;
+    }
+
+    left = black_height(n->rb_left, n);
+    right = black_height(n->rb_right, n);
+    if (left < 0 || left != right) {
+        return -1;
+    }
+
+    return left + (n->rb_color == RB_BLACK);
+}
+
+static int
+count_in_order()
+{
+    int count = 0;
+    int last = -1;
+
+    for (struct rb_node *n = rb_first(&root); n != NULL; n = rb_next(n)) {
+        int key = rb_entry(n, struct item, node)->key;
+
+        if (key < last) {
+            return -1;
+        }
+        last = key;
+        count++;
+    }
+
+    return count;
+}
+
+void
+RbtreeTest::setUp()
+{
+    root = RB_ROOT;
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        // Scrambled keys, with duplicates.
+        items[i].key = (i * 37) % 61;
+    }
+}
+
+
+void
+RbtreeTest::tearDown()
+{
+}
+
+
+void
+RbtreeTest::testEmpty()
+{
+    // Verify
+    CPPUNIT_ASSERT(  RB_EMPTY_ROOT(&root) );
+    CPPUNIT_ASSERT(  rb_first(&root) == NULL );
+    CPPUNIT_ASSERT(  rb_last(&root) == NULL );
+}
+
+void
+RbtreeTest::testInsertInOrder()
+{
+    // Exercise
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        insert(&items[i]);
+    }
+
+    // Verify
+    CPPUNIT_ASSERT(  black_height(root.rb_node, NULL) > 0 );
+    CPPUNIT_ASSERT(  count_in_order() == NUM_ITEMS );
+    CPPUNIT_ASSERT(  rb_entry(rb_first(&root), struct item, node)->key == 0 );
+    CPPUNIT_ASSERT(  rb_entry(rb_last(&root), struct item, node)->key == 60 );
+}
+
+void
+RbtreeTest::testEraseFirst()
+{
+    // Setup
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        insert(&items[i]);
+    }
+
+    // Exercise
+    for (int i = 0; i < NUM_ITEMS / 2; i++) {
+        rb_erase(rb_first(&root), &root);
+    }
+
+    // Verify
+    CPPUNIT_ASSERT(  black_height(root.rb_node, NULL) > 0 );
+    CPPUNIT_ASSERT(  count_in_order() == NUM_ITEMS - NUM_ITEMS / 2 );
+}
+
+void
+RbtreeTest::testEraseAll()
+{
+    // Setup
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        insert(&items[i]);
+    }
+
+    // Exercise
+    for (int i = 0; i < NUM_ITEMS; i += 2) {
+        rb_erase(&items[i].node, &root);
+        CPPUNIT_ASSERT(  black_height(root.rb_node, NULL) > 0 );
+    }
+    for (int i = 1; i < NUM_ITEMS; i += 2) {
+        rb_erase(&items[i].node, &root);
+        CPPUNIT_ASSERT(  black_height(root.rb_node, NULL) > 0 );
+    }
+
+    // Verify
+    CPPUNIT_ASSERT(  RB_EMPTY_ROOT(&root) );
+}
+
+void
+RbtreeTest::testPrev()
+{
+    int count = 0;
+
+    // Setup
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        insert(&items[i]);
+    }
+
+    // Exercise
+    for (struct rb_node *n = rb_last(&root); n != NULL; n = rb_prev(n)) {
+        count++;
+    }
+
+    // Verify
+    CPPUNIT_ASSERT(  count == NUM_ITEMS );
+}
@@ -0,0 +1,27 @@
+#ifndef RBTREE_TEST_H
+#define RBTREE_TEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class RbtreeTest : public CppUnit::TestFixture
+{
+  CPPUNIT_TEST_SUITE( RbtreeTest );
+  CPPUNIT_TEST( testEmpty );
+  CPPUNIT_TEST( testInsertInOrder );
+  CPPUNIT_TEST( testEraseFirst );
+  CPPUNIT_TEST( testEraseAll );
+  CPPUNIT_TEST( testPrev );
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  void setUp();
+  void tearDown();
+
+  void testEmpty();
+  void testInsertInOrder();
+  void testEraseFirst();
+  void testEraseAll();
+  void testPrev();
+};
+
+#endif  // RBTREE_TEST_H
@@ -7,7 +7,7 @@ static struct mem_pool malloc_pool;
 
 void init_malloc_free(void)
 {
-	init_mm(&malloc_pool, sbrk, NULL, NULL, NULL, NULL);
+	init_mm(&malloc_pool, sbrk, NULL, NULL, NULL, NULL, NULL, NULL);
 	printf("get_pool_malloc_total_length=%d\n",
 	       get_pool_malloc_total_length(&malloc_pool));
 }
@@ -166,3 +166,173 @@ ssize_t write(int fd, const void *buf, size_t count)
 
 	return __res;
 }
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask)
+{
+	long __res;
+
+	if (pid < 0 || mask == NULL) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_sched_setaffinity"\n\t"
+		"mov X0, %1\n\t"
+		"mov X1, %2\n\t"
+		"mov X2, %3\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (pid), "r" (cpusetsize), "r" (mask)
+		: "memory");
+
+	return __res;
+}
+
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask)
+{
+	long __res;
+
+	if (pid < 0 || mask == NULL) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_sched_getaffinity"\n\t"
+		"mov X0, %1\n\t"
+		"mov X1, %2\n\t"
+		"mov X2, %3\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (pid), "r" (cpusetsize), "r" (mask)
+		: "memory");
+
+	/* The kernel returns the size of its mask, return 0 like glibc. */
+	return __res < 0 ? -1 : 0;
+}
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param)
+{
+	long __res;
+
+	if (pid < 0 || param == NULL) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_sched_setscheduler"\n\t"
+		"mov X0, %1\n\t"
+		"mov X1, %2\n\t"
+		"mov X2, %3\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (pid), "r" ((long)policy), "r" (param)
+		: "memory");
+
+	return __res;
+}
+
+int sched_getscheduler(pid_t pid)
+{
+	long __res;
+
+	if (pid < 0) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_sched_getscheduler"\n\t"
+		"mov X0, %1\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (pid));
+
+	return __res;
+}
+
+int getrusage(int who, struct rusage *usage)
+{
+	long __res;
+
+	if (usage == NULL) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_getrusage"\n\t"
+		"mov X0, %1\n\t"
+		"mov X1, %2\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" ((long)who), "r" (usage)
+		: "memory");
+
+	return __res;
+}
+
+pid_t wait4(pid_t pid, int *status, int options, struct rusage *rusage)
+{
+	long __res;
+
+	asm volatile (
+		"mov X8, "__NR_wait4"\n\t"
+		"mov X0, %1\n\t"
+		"mov X1, %2\n\t"
+		"mov X2, %3\n\t"
+		"mov X3, %4\n\t"
+		"svc #0\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (pid), "r" (status), "r" ((long)options), "r" (rusage)
+		: "x0", "x1", "x2", "x3", "x8", "memory");
+
+	return __res;
+}
+
+pid_t waitpid(pid_t pid, int *status, int options)
+{
+	return wait4(pid, status, options, NULL);
+}
+
+pid_t wait(int *status)
+{
+	return wait4(-1, status, 0, NULL);
+}
+
+/*
+ * The child can't return from here, it may be on another stack: it calls fn
+ * and exits right away.
+ */
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, void *tls)
+{
+	long __res;
+
+	if (fn == NULL) {
+		return -1;
+	}
+
+	asm volatile (
+		"mov X8, "__NR_clone"\n\t"
+		"mov X0, %3\n\t"
+		"mov X1, %2\n\t"
+		"mov X2, %5\n\t"
+		"mov X9, %1\n\t"
+		"mov X10, %4\n\t"
+		"svc #0\n\t"
+		"cbnz X0, 1f\n\t"
+		"mov X0, X10\n\t"
+		"blr X9\n\t"
+		"mov X8, "__NR_exit"\n\t"
+		"svc #0\n\t"
+		"1:\n\t"
+		"mov %0, X0\n\t"
+		: "=r" (__res)
+		: "r" (fn), "r" (stack), "r" ((long)flags), "r" (arg), "r" (tls)
+		: "x0", "x1", "x2", "x8", "x9", "x10", "x30", "memory");
+
+	return __res;
+}
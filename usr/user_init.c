@@ -11,12 +11,20 @@ int test_data_value = 1;
 int test_bss_value;
 
 static int test_sbrk(void);
+static int test_zero_page(void);
 static void test_user_stack(void);
 static int test_sbrk_unmap(void);
 static void test_user_exit(void);
 static void test_malloc_free(void);
 static int test_user_exec_kernel(void);
 static int test_user_read_kernel(void);
+static int test_sched_affinity(void);
+static int test_sched_policy(void);
+static int test_getrusage(void);
+static int test_fpsimd(void);
+static int test_wait(void);
+static int test_clone(void);
+static int test_cow(void);
 static int shell_main(void);
 
 int init(void)
@@ -33,6 +41,7 @@ int init(void)
 		printf("In child\n");
 
 		test_sbrk();
+		test_zero_page();
 		_exit(0);
 	} else {
 		printf("fork failed, ret=%d\n", ret);
@@ -69,6 +78,40 @@ int init(void)
 		_exit(0);
 	}
 
+	ret = fork();
+	if (ret > 0) {
+	} else if (ret == 0) {
+		test_sched_affinity();
+		test_sched_policy();
+		test_getrusage();
+		_exit(0);
+	} else {
+		printf("fork failed, ret=%d\n", ret);
+		_exit(0);
+	}
+
+	ret = fork();
+	if (ret > 0) {
+	} else if (ret == 0) {
+		test_fpsimd();
+		_exit(0);
+	} else {
+		printf("fork failed, ret=%d\n", ret);
+		_exit(0);
+	}
+
+	ret = fork();
+	if (ret > 0) {
+	} else if (ret == 0) {
+		test_wait();
+		test_clone();
+		test_cow();
+		_exit(0);
+	} else {
+		printf("fork failed, ret=%d\n", ret);
+		_exit(0);
+	}
+
 	ret = fork();
 	if (ret > 0) {
 	} else if (ret == 0) {
@@ -125,9 +168,18 @@ int init(void)
 		_exit(0);
 	}
 
+	/* Collect the exit codes of the children. */
 	while (true) {
-		printf("Entering pause()\n");
-		pause();
+		int status;
+
+		ret = wait(&status);
+		if (ret > 0) {
+			printf("child %d exited, status=%d\n", ret,
+			       WEXITSTATUS(status));
+		} else {
+			printf("Entering pause()\n");
+			pause();
+		}
 	}
 
 	return test_data_value;
@@ -287,3 +339,368 @@ static int test_user_read_kernel(void)
 
 	return 0;
 }
+
+static int test_sched_affinity(void)
+{
+	cpu_set_t set;
+	int failed = false;
+	int cpu;
+
+	for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof (set), &set) != 0) {
+			printf("sched_setaffinity failed, cpu=%d\n", cpu);
+			failed = true;
+			break;
+		}
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof (set), &set) != 0 ||
+		    !CPU_ISSET(cpu, &set) || set.__bits[0] != (1UL << cpu)) {
+			printf("sched_getaffinity mismatch, cpu=%d\n", cpu);
+			failed = true;
+			break;
+		}
+	}
+
+	CPU_ZERO(&set);
+	if (sched_setaffinity(0, sizeof (set), &set) == 0) {
+		printf("sched_setaffinity accepted an empty set\n");
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test sched affinity failed\n");
+	} else {
+		printf("test sched affinity success\n");
+	}
+
+	return 0;
+}
+
+static int test_sched_policy(void)
+{
+	struct sched_param param;
+	int failed = false;
+
+	param.sched_priority = 10;
+	if (sched_setscheduler(0, SCHED_RR, &param) != 0 ||
+	    sched_getscheduler(0) != SCHED_RR) {
+		printf("set SCHED_RR failed\n");
+		failed = true;
+	}
+
+	param.sched_priority = MAX_USER_RT_PRIO;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+		printf("sched_setscheduler accepted priority %d\n",
+		       param.sched_priority);
+		failed = true;
+	}
+
+	param.sched_priority = 0;
+	if (sched_setscheduler(0, SCHED_NORMAL, &param) != 0 ||
+	    sched_getscheduler(0) != SCHED_NORMAL) {
+		printf("set SCHED_NORMAL failed\n");
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test sched policy failed\n");
+	} else {
+		printf("test sched policy success\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Parent and child keep a different value in d8 while sleeping, so that the
+ * other one runs in between, and compute with doubles.
+ */
+static int test_fpsimd(void)
+{
+	struct timespec req = {0, 10 * 1000 * 1000};
+	struct timespec rem;
+	unsigned long pattern, value;
+	double x = 1.0;
+	int failed = false;
+	int ret;
+	int i;
+
+	ret = fork();
+	if (ret < 0) {
+		printf("fork failed, ret=%d\n", ret);
+		return -1;
+	}
+	pattern = (ret == 0) ? 0x5555aaaa5555aaaaUL : 0x0123456789abcdefUL;
+
+	for (i = 0; i < 10; i++) {
+		asm volatile ("fmov d8, %0" : : "r" (pattern) : "d8");
+		nanosleep(&req, &rem);
+		x = x * 2.0 + 0.5;
+		asm volatile ("fmov %0, d8" : "=r" (value));
+		if (value != pattern) {
+			failed = true;
+		}
+	}
+	if (x != 1535.5) {
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test fpsimd failed\n");
+	} else {
+		printf("test fpsimd success\n");
+	}
+	if (ret == 0) {
+		_exit(0);
+	}
+
+	return 0;
+}
+
+static long timeval_to_usecs(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Times never go backwards, and a busy loop is charged as user time. */
+static int test_getrusage(void)
+{
+	struct rusage before, after;
+	volatile int i;
+	int failed = false;
+
+	if (getrusage(RUSAGE_SELF, &before) != 0) {
+		printf("test getrusage failed\n");
+		return -1;
+	}
+	for (i = 0; i < 1000000; i++) {
+		;
+	}
+	if (getrusage(RUSAGE_SELF, &after) != 0) {
+		printf("test getrusage failed\n");
+		return -1;
+	}
+
+	if (timeval_to_usecs(&after.ru_utime) <=
+	    timeval_to_usecs(&before.ru_utime)) {
+		printf("utime did not increase\n");
+		failed = true;
+	}
+	if (timeval_to_usecs(&after.ru_stime) <
+	    timeval_to_usecs(&before.ru_stime)) {
+		printf("stime went backwards\n");
+		failed = true;
+	}
+	if (getrusage(-1, &after) == 0) {
+		printf("getrusage accepted who -1\n");
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test getrusage failed\n");
+	} else {
+		printf("test getrusage success\n");
+	}
+
+	return 0;
+}
+
+/* The exit code is collected once, WNOHANG doesn't wait for it. */
+static int test_wait(void)
+{
+	struct timespec req = {0, 100 * 1000 * 1000};
+	struct timespec rem;
+	int status = 0;
+	int failed = false;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		printf("fork failed, ret=%d\n", pid);
+		return -1;
+	}
+	if (pid == 0) {
+		nanosleep(&req, &rem);
+		_exit(42);
+	}
+
+	if (waitpid(pid, &status, WNOHANG) != 0) {
+		printf("waitpid WNOHANG did not return 0\n");
+		failed = true;
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 42) {
+		printf("waitpid returned a wrong status=%d\n", status);
+		failed = true;
+	}
+	if (waitpid(pid, &status, 0) != -1) {
+		printf("waitpid of a reaped child did not fail\n");
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test wait failed\n");
+	} else {
+		printf("test wait success\n");
+	}
+
+	return 0;
+}
+
+static volatile int clone_shared;
+
+/* arg is the thread pointer, it must survive the context switches. */
+static int clone_thread(void *arg)
+{
+	struct timespec req = {0, 10 * 1000 * 1000};
+	struct timespec rem;
+	unsigned long tp;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		nanosleep(&req, &rem);
+		asm volatile ("mrs %0, tpidr_el0" : "=r" (tp));
+		if (tp != (unsigned long)arg) {
+			return 1;
+		}
+	}
+	__atomic_add_fetch(&clone_shared, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static int clone_nop(void *arg)
+{
+	return 0;
+}
+
+/*
+ * Threads share the data of the process, each has its own TPIDR_EL0. The
+ * stack slots of exited threads are reused.
+ */
+static int test_clone(void)
+{
+	pid_t pids[2];
+	int status;
+	int failed = false;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		pids[i] = clone(clone_thread, NULL, CLONE_VM | CLONE_SETTLS,
+				(void *)(0x1000UL + i), (void *)(0x1000UL + i));
+		if (pids[i] < 0) {
+			printf("clone failed, ret=%d\n", pids[i]);
+			failed = true;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		if (pids[i] < 0) {
+			continue;
+		}
+		if (waitpid(pids[i], &status, 0) != pids[i] ||
+		    WEXITSTATUS(status) != 0) {
+			printf("thread %d failed, status=%d\n", pids[i], status);
+			failed = true;
+		}
+	}
+	if (clone_shared != 2) {
+		printf("clone_shared=%d\n", clone_shared);
+		failed = true;
+	}
+	for (i = 0; i < 40; i++) {
+		pids[0] = clone(clone_nop, NULL, CLONE_VM, NULL, NULL);
+		if (pids[0] < 0 || waitpid(pids[0], &status, 0) != pids[0]) {
+			printf("clone %d failed, ret=%d\n", i, pids[0]);
+			failed = true;
+			break;
+		}
+	}
+
+	if (failed) {
+		printf("test clone failed\n");
+	} else {
+		printf("test clone success\n");
+	}
+
+	return 0;
+}
+
+static int cow_value = 1;
+
+/* Parent and child share the pages after fork, each sees its own writes. */
+static int test_cow(void)
+{
+	int stack_value = 1;
+	int status = 0;
+	int failed = false;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		printf("fork failed, ret=%d\n", pid);
+		return -1;
+	}
+	if (pid == 0) {
+		cow_value = 2;
+		stack_value = 2;
+		_exit(cow_value + stack_value);
+	}
+
+	/* The kernel writes status to a page shared with the child. */
+	if (waitpid(pid, &status, 0) != pid || WEXITSTATUS(status) != 4) {
+		printf("child saw wrong values, status=%d\n", status);
+		failed = true;
+	}
+	if (cow_value != 1 || stack_value != 1) {
+		printf("cow_value=%d, stack_value=%d\n", cow_value, stack_value);
+		failed = true;
+	}
+	cow_value = 3;
+	if (cow_value != 3) {
+		printf("write after the child exited lost\n");
+		failed = true;
+	}
+
+	if (failed) {
+		printf("test cow failed\n");
+	} else {
+		printf("test cow success\n");
+	}
+
+	return 0;
+}
+
+/* Fresh heap pages read as zero, before and after their first write. */
+static int test_zero_page(void)
+{
+	int increment = PAGE_SIZE * 4;
+	volatile char *p;
+	int failed = false;
+	int i;
+
+	p = sbrk(increment);
+	if (p == (void *)-1) {
+		printf("test zero page failed\n");
+		return -1;
+	}
+	for (i = 0; i < increment; i++) {
+		if (p[i] != 0) {
+			failed = true;
+		}
+	}
+	p[PAGE_SIZE] = 0x5a;
+	if (p[PAGE_SIZE] != 0x5a || p[PAGE_SIZE + 1] != 0 || p[0] != 0) {
+		failed = true;
+	}
+	sbrk(0-increment);
+
+	if (failed) {
+		printf("test zero page failed\n");
+	} else {
+		printf("test zero page success\n");
+	}
+
+	return 0;
+}